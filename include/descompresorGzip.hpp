@@ -0,0 +1,137 @@
+#ifndef DESCOMPRESORGZIP_H
+#define DESCOMPRESORGZIP_H
+
+#include <climits>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+/**
+ * Descompresor de archivos gzip que trabaja en un hilo aparte y entrega el contenido por
+ * bloques de tamaño fijo. El hilo se adelanta hasta MAX_READY bloques al consumidor, así la
+ * descompresión ocurre mientras se procesan los bloques anteriores. Los archivos bgzip (BGZF)
+ * son archivos gzip de varios miembros y se descomprimen igual
+ */
+class DescompresorGzip {
+private:
+    struct Block {
+        std::vector<char> data;
+        size_t size = 0;
+    };
+
+    gzFile file;
+    std::string filename;
+    size_t blockSize;
+    // Bloques descomprimidos en orden y bloques ya consumidos que el hilo puede reutilizar
+    std::deque<Block> ready;
+    std::vector<Block> spare;
+    bool finished;
+    bool stopping;
+    std::string error;
+    std::mutex mutex;
+    std::condition_variable blockReady, blockConsumed;
+    std::thread worker;
+
+    static constexpr size_t MAX_READY = 2;
+
+public:
+    /**
+     * Abre el archivo y empieza a descomprimirlo en segundo plano
+     * @param filename Ruta al archivo gzip
+     * @param blockSize Bytes descomprimidos de cada bloque
+     */
+    DescompresorGzip(const std::string& filename, size_t blockSize)
+        : filename(filename), blockSize(blockSize), finished(false), stopping(false) {
+        if (blockSize == 0 || blockSize > INT_MAX) {
+            throw std::invalid_argument("El tamaño de bloque debe pertenecer a [1, INT_MAX]");
+        }
+        file = gzopen(filename.c_str(), "rb");
+        if (file == nullptr) throw std::runtime_error("No se pudo abrir: " + filename);
+        gzbuffer(file, 1 << 17);
+        worker = std::thread([this] { decompress(); });
+    }
+
+    DescompresorGzip(const DescompresorGzip&) = delete;
+    DescompresorGzip& operator=(const DescompresorGzip&) = delete;
+
+    ~DescompresorGzip() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        blockConsumed.notify_one();
+        worker.join();
+        gzclose(file);
+    }
+
+    /**
+     * Entrega el siguiente bloque descomprimido intercambiándolo por block, cuyo contenido ya
+     * fue consumido y pasa a ser reutilizado por el hilo
+     * @param block Bloque a reemplazar por el siguiente
+     * @param size Bytes válidos del bloque entregado
+     * @return true si se entregó un bloque, false si se acabó el archivo
+     */
+    bool nextBlock(std::vector<char>& block, size_t& size) {
+        std::unique_lock<std::mutex> lock(mutex);
+        blockReady.wait(lock, [this] { return !ready.empty() || finished; });
+        if (ready.empty()) {
+            if (!error.empty()) throw std::runtime_error(error);
+            return false;
+        }
+
+        Block next = std::move(ready.front());
+        ready.pop_front();
+        block.swap(next.data);
+        size = next.size;
+        if (next.data.size() == blockSize) spare.push_back(std::move(next));
+        lock.unlock();
+        blockConsumed.notify_one();
+        return true;
+    }
+
+private:
+    /**
+     * Ciclo del hilo: descomprime bloques mientras el consumidor no tenga MAX_READY pendientes
+     */
+    void decompress() {
+        while (true) {
+            Block block;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                blockConsumed.wait(lock, [this] { return ready.size() < MAX_READY || stopping; });
+                if (stopping) return;
+                if (!spare.empty()) {
+                    block = std::move(spare.back());
+                    spare.pop_back();
+                }
+            }
+
+            block.data.resize(blockSize);
+            int bytesRead = gzread(file, block.data.data(), static_cast<unsigned>(blockSize));
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if (bytesRead <= 0) {
+                // gzread también devuelve 0 en un archivo truncado (Z_BUF_ERROR), así que el
+                // fin solo es limpio si zlib no registró ningún error
+                int errnum;
+                const char* message = gzerror(file, &errnum);
+                if (bytesRead < 0 || (errnum != Z_OK && errnum != Z_STREAM_END)) {
+                    error = "Error descomprimiendo " + filename + ": " + message;
+                }
+                finished = true;
+                blockReady.notify_one();
+                return;
+            }
+            block.size = static_cast<size_t>(bytesRead);
+            ready.push_back(std::move(block));
+            blockReady.notify_one();
+        }
+    }
+};
+
+#endif // DESCOMPRESORGZIP_H
@@ -11,9 +11,52 @@
 #include <fstream>
 #include <string>
 #include "../source/cooled-kll.cpp"
+#include "../source/hybrid-sketch.cpp"
+#include "../source/background-kll.cpp"
+#include "../source/log-histogram.cpp"
+
+// Motor de cuantiles usado en los experimentos
+// COOLED_KLL: el Cooled-KLL | LOG_HISTOGRAM: histograma logaritmico
+// HYBRID: histograma exacto que pasa al Cooled-KLL si hay muchos valores distintos
+// BACKGROUND: Cooled-KLL cuyas compactaciones corren en un hilo aparte
+enum class Engine { COOLED_KLL = 0, LOG_HISTOGRAM = 1, HYBRID = 2, BACKGROUND = 3 };
+
+// Nombre de la carpeta de resultados segun el motor y la configuracion del sketch
+std::string sketchFolder(size_t n_buckets, size_t buckets_capacity, int compactor_size, Engine engine){
+    if (engine == Engine::LOG_HISTOGRAM){
+        return "LOG_RA_" + std::to_string(static_cast<int>(std::round(LogHistogram<>::DEFAULT_ACCURACY * 100)));
+    }
+    std::string folder = "NB_"+std::to_string(n_buckets)+"_BC_"+std::to_string(buckets_capacity)+"_CS_"+std::to_string(compactor_size);
+    if (engine == Engine::HYBRID) return "HYB_" + folder;
+    if (engine == Engine::BACKGROUND) return "BG_" + folder;
+    return folder;
+}
+
+// Construye el motor indicado y se lo entrega a estimar
+template <typename Estimar>
+void withEngine(Engine engine, size_t n_buckets, size_t buckets_capacity, int eviction_threshold, int compactor_size,
+     float compression_factor, Estimar estimar){
+    if (engine == Engine::LOG_HISTOGRAM){
+        LogHistogram<> sketch;
+        estimar(sketch);
+    } else if (engine == Engine::HYBRID){
+        withCooledKLL(n_buckets, buckets_capacity, eviction_threshold, compactor_size, compression_factor, [&](auto& sketch){
+            HybridSketch hybrid(sketch);
+            estimar(hybrid);
+        });
+    } else if (engine == Engine::BACKGROUND){
+        withCooledKLL(n_buckets, buckets_capacity, eviction_threshold, compactor_size, compression_factor, [&](auto& sketch){
+            BackgroundKLL background(sketch);
+            estimar(background);
+        });
+    } else {
+        withCooledKLL(n_buckets, buckets_capacity, eviction_threshold, compactor_size, compression_factor, estimar);
+    }
+}
 
 void frequencyExperiments(std::vector<std::pair<uint64_t, uint64_t>>& kmers_dist, int k_, float quantile_ratio,
-     size_t n_buckets=100, size_t buckets_capacity = 10, int compactor_size = 100, float compression_factor = 0.7){
+     size_t n_buckets=100, size_t buckets_capacity = 10, int compactor_size = 100, float compression_factor = 0.7,
+     Engine engine = Engine::COOLED_KLL){
     std::cout << "!ESTIMACION DE DISTRIBUCION DE FRECUENCIAS!" << std::endl;
     std::cout << "!Ordenando la distribucion de frecuencias!" << std::endl;
 
@@ -89,22 +132,39 @@ void frequencyExperiments(std::vector<std::pair<uint64_t, uint64_t>>& kmers_dist
 
     std::vector<std::pair<uint64_t, uint64_t>>().swap(compressed_vector);
 
+    // Cuantiles y elementos cuyo rank se va a estimar
+    std::vector<double> deltas;
+    std::vector<int_t> rank_items;
+    size_t j = 0;
+    for (double i=0.0 ; i <= 1.00000 ; i+=quantile_ratio){
+        deltas.push_back(i);
+        rank_items.push_back(kmers_dist[real_ranks[j] - 1].second);
+        j++;
+    }
+
     // Inserta en el sketch todas las frecuencias de los kmers
     int eviction_threshold = 16;
+    std::vector<int_t> estimated_quantiles;
+    std::vector<size_t> estimated_ranks;
+    size_t sketch_memory;
 
-    CooledKLL sketch(n_buckets, buckets_capacity, eviction_threshold, compactor_size, compression_factor);
+    auto estimar = [&](auto& sketch){
+        std::cout << "Insertando datos en el sketch" << std::endl;
 
-    std::cout << "Insertando datos en el sketch" << std::endl;
+        sketch.insert_batch(std::span(kmers_dist), [](const std::pair<uint64_t, size_t>& kmer){
+            return kmer.second;
+        });
 
-    for (size_t i=0 ; i<kmers_dist.size() ; i++){
-        sketch.insert(kmers_dist[i].second);
-    }
+        // Obtiene los cuantiles y ranks estimados en una sola pasada sobre el sketch
+        estimated_quantiles = sketch.quantiles(deltas);
+        estimated_ranks = sketch.ranks(rank_items);
+        sketch_memory = sketch.memory();
+    };
+    withEngine(engine, n_buckets, buckets_capacity, eviction_threshold, compactor_size, compression_factor, estimar);
 
     std::cout << "!Estimando y guardando distribución de los datos!" << std::endl;
 
-    std::filesystem::path folder_route = "data/frequency_distribution/NB_"+
-                    std::to_string(n_buckets)+"_BC_"+std::to_string(buckets_capacity)+"_CS_"
-                    +std::to_string(compactor_size);
+    std::filesystem::path folder_route = "data/frequency_distribution/" + sketchFolder(n_buckets, buckets_capacity, compactor_size, engine);
 
     try{
         if (not std::filesystem::exists(folder_route)){
@@ -119,16 +179,10 @@ void frequencyExperiments(std::vector<std::pair<uint64_t, uint64_t>>& kmers_dist
     if (csvFile.is_open()){
         csvFile << "quantile,real_quantile,estimated_quantile,rank,real_rank,estimated_rank\n";
 
-        // Obtiene los cuantiles estimados y guarda los datos en un csv
-        size_t estimated_quantile, estimated_rank, j = 0;
-        for (double i=0.0 ; i <= 1.00000 ; i+=quantile_ratio){
-            estimated_quantile = sketch.quantile(i);
-            estimated_rank = sketch.rank(kmers_dist[real_ranks[j] - 1].second);
-
-            csvFile << i << "," << real_quantiles[j] << "," << estimated_quantile << "," << 
-            kmers_dist[real_ranks[j] - 1].second << "," << real_ranks[j] << "," << estimated_rank << std::endl;
-
-            j++;
+        // Guarda los datos en un csv
+        for (j=0 ; j<deltas.size() ; j++){
+            csvFile << deltas[j] << "," << real_quantiles[j] << "," << estimated_quantiles[j] << "," << 
+            rank_items[j] << "," << real_ranks[j] << "," << estimated_ranks[j] << std::endl;
         }
 
         csvFile.close();
@@ -143,7 +197,7 @@ void frequencyExperiments(std::vector<std::pair<uint64_t, uint64_t>>& kmers_dist
     std::ofstream csvFile1(csvFilename);
     if (csvFile1.is_open()){
         csvFile1 << "elements,unique_elements,sketch_memory,vector_memory,compressed_vector_memory,n_buckets,b_capacity,comp_size,comp_factor\n";
-        csvFile1 << total_kmers << "," << unique_elements << "," << sketch.memory() << "," << vector_memory << "," << cv_memory
+        csvFile1 << total_kmers << "," << unique_elements << "," << sketch_memory << "," << vector_memory << "," << cv_memory
          << "," << n_buckets << "," << buckets_capacity << "," << compactor_size << "," << compression_factor << std::endl;
 
         csvFile1.close();
@@ -153,7 +207,8 @@ void frequencyExperiments(std::vector<std::pair<uint64_t, uint64_t>>& kmers_dist
 }
 
 void kmersExperiments(std::vector<std::pair<uint64_t, uint64_t>> kmers_dist, int k_, float quantile_ratio,
-     size_t n_buckets=100, size_t buckets_capacity = 10, int compactor_size = 100, float compression_factor = 0.7){
+     size_t n_buckets=100, size_t buckets_capacity = 10, int compactor_size = 100, float compression_factor = 0.7,
+     Engine engine = Engine::COOLED_KLL){
     std::cout << "!ESTIMACION DE DISTRIBUCION DE KMERS!" << std::endl;
     std::cout << "!Calculando distribucion real de los datos!" << std::endl;
 
@@ -237,20 +292,37 @@ void kmersExperiments(std::vector<std::pair<uint64_t, uint64_t>> kmers_dist, int
 
     std::vector<std::pair<uint64_t, uint64_t>>().swap(compressed_vector);
 
+    // Cuantiles y elementos cuyo rank se va a estimar
+    std::vector<double> deltas;
+    std::vector<int_t> rank_items;
+    size_t j = 0;
+    for (double i=0.0 ; i <= 1.00000 ; i+=quantile_ratio){
+        deltas.push_back(i);
+        rank_items.push_back(kmers[real_ranks[j] - 1]);
+        j++;
+    }
+
     std::cout << "!Insertando datos en el sketch!" << std::endl;
 
     // Inserta en el sketch todos los kmers
     int eviction_threshold = 16;
-    CooledKLL sketch(n_buckets, buckets_capacity, eviction_threshold, compactor_size, compression_factor);
-    for (size_t i=0 ; i<different_kmers ; i++){
-        sketch.insert(kmers_dist[i].first, kmers_dist[i].second);
-    }
+    std::vector<int_t> estimated_quantiles;
+    std::vector<size_t> estimated_ranks;
+    size_t sketch_memory;
+
+    auto estimar = [&](auto& sketch){
+        sketch.insert_batch(kmers_dist);
+
+        // Obtiene los cuantiles y ranks estimados en una sola pasada sobre el sketch
+        estimated_quantiles = sketch.quantiles(deltas);
+        estimated_ranks = sketch.ranks(rank_items);
+        sketch_memory = sketch.memory();
+    };
+    withEngine(engine, n_buckets, buckets_capacity, eviction_threshold, compactor_size, compression_factor, estimar);
 
     std::cout << "!Estimando y guardando distribución de los datos!" << std::endl;
 
-    std::filesystem::path folder_route = "data/kmers_distribution/NB_"+
-                    std::to_string(n_buckets)+"_BC_"+std::to_string(buckets_capacity)+"_CS_"
-                    +std::to_string(compactor_size);
+    std::filesystem::path folder_route = "data/kmers_distribution/" + sketchFolder(n_buckets, buckets_capacity, compactor_size, engine);
 
     try{
         if (not std::filesystem::exists(folder_route)){
@@ -266,17 +338,10 @@ void kmersExperiments(std::vector<std::pair<uint64_t, uint64_t>> kmers_dist, int
     if (csvFile.is_open()){
         csvFile << "quantile,real_quantile,estimated_quantile,rank,real_rank,estimated_rank\n";
 
-        // Obtiene los cuantiles estimados y guarda los datos en un csv
-        uint64_t estimated_quantile, j = 0;
-        size_t estimated_rank;
-        for (double i=0.0 ; i <= 1.00000 ; i+=quantile_ratio){
-            estimated_quantile = sketch.quantile(i);
-            estimated_rank = sketch.rank(kmers[real_ranks[j] - 1]);
-
-            csvFile << i << "," << real_quantiles[j] << "," << estimated_quantile << 
-            "," << kmers[real_ranks[j] - 1] << "," << real_ranks[j] << "," << estimated_rank << std::endl;
-
-            j++;
+        // Guarda los datos en un csv
+        for (j=0 ; j<deltas.size() ; j++){
+            csvFile << deltas[j] << "," << real_quantiles[j] << "," << estimated_quantiles[j] << 
+            "," << rank_items[j] << "," << real_ranks[j] << "," << estimated_ranks[j] << std::endl;
         }
 
         csvFile.close();
@@ -291,7 +356,7 @@ void kmersExperiments(std::vector<std::pair<uint64_t, uint64_t>> kmers_dist, int
     std::ofstream csvFile1(csvFilename);
     if (csvFile1.is_open()){
         csvFile1 << "elements,unique_elements,sketch_memory,vector_memory,compressed_vector_memory,n_buckets,b_capacity,comp_size,comp_factor\n";
-        csvFile1 << total_kmers << "," << unique_elements << "," << sketch.memory() << "," << vector_memory << "," << cv_memory
+        csvFile1 << total_kmers << "," << unique_elements << "," << sketch_memory << "," << vector_memory << "," << cv_memory
          << "," << n_buckets << "," << buckets_capacity << "," << compactor_size << "," << compression_factor << std::endl;
 
         csvFile1.close();
@@ -7,27 +7,201 @@
 #include <stdexcept>
 #include <filesystem>
 #include <vector>
+#include <memory>
+#include <cstring>
+#include <string_view>
+#include <future>
+#include "../source/mapped-file.cpp"
+
+// Los archivos comprimidos con gzip (.gz) solo se leen al compilar con -DLECTOR_GZIP, lo que
+// requiere zlib y enlazar con -lz. Sin esa opción los archivos comprimidos se omiten
+#ifdef LECTOR_GZIP
+#include "descompresorGzip.hpp"
+#endif
+
+/**
+ * Forma en que se leen los archivos
+ * COPY: el archivo se copia completo en memoria sin saltos de línea ni cabeceras, lo que
+ *       permite acceder a la secuencia por posición (getBaseAt, getNextKmer, ...)
+ * MMAP: el archivo se mapea en memoria y las bases se entregan con nextFragment directamente
+ *       desde el mapeo, sin copiarlas
+ * STREAM: el archivo se lee por bloques de tamaño fijo que se entregan con nextFragment, por
+ *         lo que la memoria usada depende del tamaño del bloque y no del archivo
+ */
+enum class ReaderBackend { COPY, MMAP, STREAM };
 
 /**
- * Clase para leer archivos genómicos en formato FASTA
- * Permite extraer k-mers de forma secuencial avanzando posición por posición
+ * Recorre el contenido de un archivo FASTA o FASTQ entregando los tramos de secuencia, sin
+ * cabeceras, saltos de línea ni retornos de carro; de un FASTQ se saltan además las líneas
+ * '+' y las de calidad. El contenido puede llegar por bloques: el estado de la línea se
+ * mantiene entre ellos, así una línea puede quedar repartida en dos bloques
+ */
+struct SequenceScanner {
+    // Tipos de línea de un registro FASTQ: @cabecera, secuencia, +separador y calidad
+    enum class FastqLine { HEADER, SEQUENCE, SEPARATOR, QUALITY };
+
+    const char* position = nullptr;
+    const char* end = nullptr;
+    bool atLineStart = true;   // si se está al inicio de una línea
+    bool skipLine = false;     // si la línea actual no es de secuencia
+    bool fastq = false;
+    // Estado FASTQ: tipo de la línea actual, bases de la lectura actual y calidades que le
+    // faltan. Las calidades se cuentan porque una línea de calidad puede empezar con '@'
+    FastqLine line = FastqLine::QUALITY;
+    size_t sequenceLength = 0;
+    size_t qualityRemaining = 0;
+    size_t record = 0;         // lecturas FASTQ comenzadas
+
+    // Comienza un archivo con su primer bloque
+    void start(const char* data, size_t size, bool isFastq = false) {
+        feed(data, size);
+        atLineStart = true;
+        skipLine = false;
+        fastq = isFastq;
+        line = FastqLine::QUALITY;
+        sequenceLength = 0;
+        qualityRemaining = 0;
+        record = 0;
+    }
+
+    // Entrega el siguiente bloque del mismo archivo
+    void feed(const char* data, size_t size) {
+        position = data;
+        end = data + size;
+    }
+
+    /**
+     * Busca el siguiente tramo de secuencia en lo que falta por escanear del bloque,
+     * saltando las cabeceras y las líneas vacías
+     * @param fragment Vista del tramo encontrado
+     * @return true si encontró un tramo, false si se acabó el bloque
+     */
+    bool next(std::string_view& fragment) {
+        while (position < end) {
+            if (atLineStart) {
+                if (*position == '\n' || *position == '\r') {
+                    position++;
+                    continue;
+                }
+                startLine(*position);
+                atLineStart = false;
+            }
+
+            const char* lineStart = position;
+            const char* newline = static_cast<const char*>(std::memchr(lineStart, '\n', end - lineStart));
+            const char* lineEnd = newline ? newline : end;
+            position = newline ? newline + 1 : end;
+            atLineStart = newline != nullptr;
+            if (lineEnd > lineStart && lineEnd[-1] == '\r') lineEnd--;
+            size_t length = lineEnd - lineStart;
+
+            if (skipLine) {
+                if (fastq && line == FastqLine::QUALITY) qualityRemaining -= std::min(length, qualityRemaining);
+                continue;
+            }
+            if (length > 0) {
+                sequenceLength += length;
+                fragment = std::string_view(lineStart, length);
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    /**
+     * Determina el tipo de la línea que comienza con el carácter c
+     */
+    void startLine(char c) {
+        if (!fastq) {
+            skipLine = c == '>';
+            return;
+        }
+        switch (line) {
+            case FastqLine::HEADER:
+            case FastqLine::SEQUENCE:
+                line = c == '+' ? FastqLine::SEPARATOR : FastqLine::SEQUENCE;
+                break;
+            case FastqLine::SEPARATOR:
+            case FastqLine::QUALITY:
+                line = qualityRemaining == 0 ? FastqLine::HEADER : FastqLine::QUALITY;
+                break;
+        }
+        if (line == FastqLine::HEADER) {
+            if (c != '@') throw std::runtime_error("Registro FASTQ mal formado: se esperaba '@'");
+            record++;
+            sequenceLength = 0;
+        } else if (line == FastqLine::SEPARATOR) {
+            qualityRemaining = sequenceLength;
+        }
+        skipLine = line != FastqLine::SEQUENCE;
+    }
+};
+
+/**
+ * Archivo listo para ser leído, según el backend: su secuencia copiada (COPY), su mapeo
+ * (MMAP) o el archivo abierto con su primer bloque ya leído (STREAM). Un archivo comprimido
+ * se descomprime por bloques con cualquier backend salvo COPY
+ */
+struct PreparedFile {
+    std::string data;
+    std::unique_ptr<MappedFile> mapping;
+    std::ifstream stream;
+#ifdef LECTOR_GZIP
+    std::unique_ptr<DescompresorGzip> gzip;
+#endif
+    std::vector<char> block;
+    size_t blockBytes = 0;
+};
+
+/**
+ * Clase para leer archivos genómicos en formato FASTA o FASTQ
+ * Permite extraer k-mers de forma secuencial avanzando posición por posición, o recorrer
+ * las bases por fragmentos con nextFragment
  */
 class LectorGenomas {
 private:
     std::string genomicData;              
     size_t currentPosition;               
-    std::vector<std::string> fastaFiles;  // Lista de archivos FASTA
+    std::vector<std::string> fastaFiles;  // Lista de archivos FASTA y FASTQ
     size_t currentFileIndex;              
     std::string currentFilename;          
     std::string genomasDirectory;         
+    ReaderBackend backend;
+
+    // Archivo actual mapeado (backend MMAP)
+    std::unique_ptr<MappedFile> mappedFile;
+    // Archivo actual (backend STREAM) o su descompresor, y el bloque donde se lee
+    std::ifstream streamFile;
+#ifdef LECTOR_GZIP
+    std::unique_ptr<DescompresorGzip> gzipFile;
+#endif
+    std::vector<char> block;
+    size_t blockSize;
+    // Escaneo del archivo mapeado o del bloque actual
+    SequenceScanner scanner;
+    // Preparación en segundo plano del archivo pendingIndex, el siguiente al actual
+    bool prefetch;
+    std::future<PreparedFile> pendingFile;
+    size_t pendingIndex;
 
 public:
+    // Tamaño por defecto de los bloques del backend STREAM: 4 MiB
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 4 << 20;
+
     /**
      * Constructor que carga todos los archivos FASTA de un directorio
      * @param directory Ruta al directorio que contiene archivos FASTA
+     * @param backend Forma en que se leen los archivos (ver ReaderBackend)
+     * @param blockSize Bytes de cada bloque leído con el backend STREAM
+     * @param prefetch Si se prepara el siguiente archivo en un hilo mientras se lee el actual.
+     *                 Mientras tanto hay dos archivos en memoria (o dos bloques con STREAM)
      */
-    LectorGenomas(const std::string& directory = "Genomas") 
-        : currentPosition(0), currentFileIndex(0), genomasDirectory(directory) {
+    LectorGenomas(const std::string& directory = "Genomas", ReaderBackend backend = ReaderBackend::COPY,
+                  size_t blockSize = DEFAULT_BLOCK_SIZE, bool prefetch = false) 
+        : currentPosition(0), currentFileIndex(0), genomasDirectory(directory), backend(backend),
+          blockSize(blockSize), prefetch(prefetch), pendingIndex(0) {
+        if (blockSize == 0) throw std::invalid_argument("El tamaño de bloque debe ser mayor que 0");
         loadFastaDirectory(directory);
         if (!fastaFiles.empty()) loadCurrentFile();
     }
@@ -46,38 +220,252 @@ public:
         for (const auto& entry : std::filesystem::directory_iterator(directory)) {
             if (entry.is_regular_file()) {
                 std::string filename = entry.path().string();
-                // Verificar que sea un archivo FASTA (extensiones .fna, .fa, .fasta)
-                if (filename.size() >= 4 && 
-                    (filename.substr(filename.size() - 4) == ".fna" ||
-                     filename.substr(filename.size() - 3) == ".fa" ||
-                     (filename.size() >= 6 && filename.substr(filename.size() - 6) == ".fasta"))) {
+                // Los archivos comprimidos se reconocen por la extensión del archivo sin comprimir
+                std::string uncompressed = uncompressedName(filename);
+#ifndef LECTOR_GZIP
+                if (uncompressed != filename) {
+                    std::cerr << "Se omite " << filename << ": el lector se compilo sin -DLECTOR_GZIP" << std::endl;
+                    continue;
+                }
+#endif
+                // Verificar que sea un archivo FASTA (extensiones .fna, .fa, .fasta) o FASTQ
+                if ((uncompressed.size() >= 4 && 
+                    (uncompressed.substr(uncompressed.size() - 4) == ".fna" ||
+                     uncompressed.substr(uncompressed.size() - 3) == ".fa" ||
+                     (uncompressed.size() >= 6 && uncompressed.substr(uncompressed.size() - 6) == ".fasta"))) ||
+                    isFastq(filename)) {
                     fastaFiles.push_back(filename);
                 }
             }
         }
         
         if (fastaFiles.empty()) {
-            throw std::runtime_error("No se encontraron archivos FASTA en el directorio: " + directory);
+            throw std::runtime_error("No se encontraron archivos FASTA ni FASTQ en el directorio: " + directory);
         }
         
-        std::cout << "Se encontraron " << fastaFiles.size() << " archivos FASTA en " << directory << std::endl;
+        std::cout << "Se encontraron " << fastaFiles.size() << " archivos FASTA/FASTQ en " << directory << std::endl;
     }
 
     /**
-     * Carga el archivo actual basado en currentFileIndex
+     * Carga el archivo actual basado en currentFileIndex. Si el archivo ya se estaba
+     * preparando en segundo plano lo espera; luego empieza a preparar el siguiente
      */
     void loadCurrentFile() {
         if (currentFileIndex >= fastaFiles.size()) throw std::out_of_range("Índice fuera de rango");
         currentFilename = fastaFiles[currentFileIndex];
-        loadFastaFile(currentFilename);
+
+        PreparedFile file;
+        if (pendingFile.valid() && pendingIndex == currentFileIndex) {
+            file = pendingFile.get();
+        } else {
+            // Se descarta lo preparado si se saltó a otro archivo (previousFile, reset)
+            if (pendingFile.valid()) pendingFile.wait();
+            pendingFile = std::future<PreparedFile>();
+            file = prepareFile(currentFilename, backend, blockSize);
+        }
+        installFile(std::move(file));
         currentPosition = 0;
+
+        if (prefetch && currentFileIndex + 1 < fastaFiles.size()) {
+            pendingIndex = currentFileIndex + 1;
+            pendingFile = std::async(std::launch::async, prepareFile, fastaFiles[pendingIndex], backend, blockSize);
+        }
     }
 
     /**
-     * Carga el contenido del archivo FASTA, omitiendo las líneas de cabecera
+     * Entrega el siguiente fragmento de bases: un tramo de una línea de secuencia, sin
+     * cabeceras, saltos de línea ni retornos de carro. Con el backend MMAP el fragmento
+     * apunta directamente al archivo mapeado y con STREAM, o con archivos comprimidos, al
+     * bloque leído, por lo que una línea que cruza dos bloques se entrega en dos fragmentos.
+     * Al acabarse el archivo actual pasa al siguiente; los fragmentos de un mismo archivo
+     * FASTA forman una única secuencia, mientras que en un FASTQ cada lectura es una
+     * secuencia aparte y getCurrentRecord cambia al comenzar cada una
+     * @param fragment Vista del fragmento, válida hasta la siguiente llamada
+     * @return true si se entregó un fragmento, false si no quedan bases en ningún archivo
+     */
+    bool nextFragment(std::string_view& fragment) {
+        while (true) {
+            if (backend == ReaderBackend::COPY) {
+                if (currentPosition < genomicData.length()) {
+                    fragment = std::string_view(genomicData).substr(currentPosition);
+                    currentPosition = genomicData.length();
+                    return true;
+                }
+            } else if (scanner.next(fragment)) {
+                return true;
+            } else if (readBlock()) {
+                continue;
+            }
+            if (!nextFile()) return false;
+        }
+    }
+
+private:
+    /**
+     * Deja un archivo listo para ser leído con el backend dado. No usa el estado del lector,
+     * por lo que puede ejecutarse en otro hilo
      * @param filename Ruta al archivo FASTA
      */
+    static PreparedFile prepareFile(std::string filename, ReaderBackend backend, size_t blockSize) {
+        PreparedFile file;
+        if (backend == ReaderBackend::COPY && (isGzip(filename) || isFastq(filename))) {
+            parseBlocks(filename, file.data, blockSize);
+            return file;
+        }
+#ifdef LECTOR_GZIP
+        if (isGzip(filename)) {
+            // El descompresor sigue trabajando en su hilo mientras se lee el primer bloque
+            file.gzip = std::make_unique<DescompresorGzip>(filename, blockSize);
+            if (!file.gzip->nextBlock(file.block, file.blockBytes)) file.blockBytes = 0;
+            return file;
+        }
+#endif
+        if (backend == ReaderBackend::MMAP) {
+            file.mapping = std::make_unique<MappedFile>(filename);
+            file.mapping->adviseSequential();
+            // Pide al kernel que empiece a leer el archivo del disco desde ya
+            file.mapping->adviseWillNeed();
+        } else if (backend == ReaderBackend::STREAM) {
+            file.stream.open(filename, std::ios::binary);
+            if (!file.stream.is_open()) throw std::runtime_error("No se pudo abrir: " + filename);
+            file.block.resize(blockSize);
+            file.stream.read(file.block.data(), file.block.size());
+            file.blockBytes = static_cast<size_t>(file.stream.gcount());
+        } else {
+            parseFastaFile(filename, file.data);
+        }
+        return file;
+    }
+
+    /**
+     * Convierte un archivo preparado en el archivo actual y deja el escaneo a su inicio
+     */
+    void installFile(PreparedFile&& file) {
+        // Lo que no usa el archivo nuevo queda vacío y se libera
+        mappedFile = std::move(file.mapping);
+        streamFile = std::move(file.stream);
+#ifdef LECTOR_GZIP
+        gzipFile = std::move(file.gzip);
+#endif
+        if (mappedFile) {
+            scanner.start(reinterpret_cast<const char*>(mappedFile->data()), mappedFile->size(), isFastq(currentFilename));
+        } else if (backend != ReaderBackend::COPY) {
+            block.swap(file.block);
+            scanner.start(block.data(), file.blockBytes, isFastq(currentFilename));
+        } else {
+            genomicData.swap(file.data);
+        }
+    }
+
+    /**
+     * Lee el siguiente bloque del archivo actual, si se lee por bloques
+     * @return true si se leyó algo, false si se acabó el archivo o no se lee por bloques
+     */
+    bool readBlock() {
+        size_t bytesRead = 0;
+#ifdef LECTOR_GZIP
+        if (gzipFile) {
+            if (!gzipFile->nextBlock(block, bytesRead)) return false;
+            scanner.feed(block.data(), bytesRead);
+            return true;
+        }
+#endif
+        if (!streamFile.is_open()) return false;
+        streamFile.read(block.data(), block.size());
+        bytesRead = static_cast<size_t>(streamFile.gcount());
+        if (bytesRead == 0) return false;
+        scanner.feed(block.data(), bytesRead);
+        return true;
+    }
+
+    /**
+     * El acceso por posición (getBaseAt, getNextKmer, ...) solo está disponible con el backend
+     * COPY, el único que deja la secuencia copiada en memoria
+     */
+    void requireCopyBackend() const {
+        if (backend != ReaderBackend::COPY) {
+            throw std::logic_error("El acceso por posición requiere el backend COPY; use nextFragment");
+        }
+    }
+
+    static bool isGzip(const std::string& filename) {
+        return filename.size() >= 3 && filename.compare(filename.size() - 3, 3, ".gz") == 0;
+    }
+
+    static std::string uncompressedName(const std::string& filename) {
+        return isGzip(filename) ? filename.substr(0, filename.size() - 3) : filename;
+    }
+
+    // Si el archivo es FASTQ (extensiones .fq, .fastq), comprimido o no
+    static bool isFastq(const std::string& filename) {
+        std::string name = uncompressedName(filename);
+        return (name.size() >= 3 && name.compare(name.size() - 3, 3, ".fq") == 0) ||
+               (name.size() >= 6 && name.compare(name.size() - 6, 6, ".fastq") == 0);
+    }
+
+    /**
+     * Copia la secuencia de un archivo comprimido o FASTQ leyéndolo por bloques. Las lecturas
+     * de un FASTQ se separan con una 'N' para que ningún k-mer quede entre dos de ellas
+     * @param filename Ruta al archivo
+     * @param genomicData String donde se deja la secuencia
+     * @param blockSize Bytes de cada bloque leído
+     */
+    static void parseBlocks(const std::string& filename, std::string& genomicData, size_t blockSize) {
+        std::vector<char> fileBlock(blockSize);
+        size_t bytesRead;
+        SequenceScanner fileScanner;
+        fileScanner.start(nullptr, 0, isFastq(filename));
+        size_t record = 0;
+        std::string_view fragment;
+        genomicData.clear();
+
+        auto scanBlock = [&]() {
+            fileScanner.feed(fileBlock.data(), bytesRead);
+            while (fileScanner.next(fragment)) {
+                if (fileScanner.record != record) {
+                    if (!genomicData.empty()) genomicData += 'N';
+                    record = fileScanner.record;
+                }
+                genomicData.append(fragment);
+            }
+        };
+
+#ifdef LECTOR_GZIP
+        if (isGzip(filename)) {
+            DescompresorGzip gzip(filename, blockSize);
+            while (gzip.nextBlock(fileBlock, bytesRead)) scanBlock();
+            return;
+        }
+#endif
+        std::ifstream file(filename, std::ios::binary);
+        if (!file.is_open()) throw std::runtime_error("No se pudo abrir: " + filename);
+        while (file.read(fileBlock.data(), fileBlock.size()) || file.gcount() > 0) {
+            bytesRead = static_cast<size_t>(file.gcount());
+            scanBlock();
+        }
+    }
+
+public:
+
+    /**
+     * Carga el contenido del archivo FASTA, omitiendo las líneas de cabecera. Las lecturas
+     * de un archivo FASTQ quedan separadas por una 'N'
+     * @param filename Ruta al archivo FASTA o FASTQ
+     */
     void loadFastaFile(const std::string& filename) {
+        if (isGzip(filename) || isFastq(filename)) {
+            parseBlocks(filename, genomicData, blockSize);
+            return;
+        }
+        parseFastaFile(filename, genomicData);
+    }
+
+    /**
+     * Copia la secuencia del archivo FASTA, omitiendo las líneas de cabecera
+     * @param filename Ruta al archivo FASTA
+     * @param genomicData String donde se deja la secuencia
+     */
+    static void parseFastaFile(const std::string& filename, std::string& genomicData) {
         std::ifstream file(filename);
         if (!file.is_open()) throw std::runtime_error("No se pudo abrir: " + filename);
 
@@ -100,11 +488,13 @@ public:
     }
 
     char getBaseAt(size_t pos) const {
+        requireCopyBackend();
         return genomicData[pos];
     }
 
     // Lógica corregida para avanzar automáticamente
     bool advancePosition() {
+        requireCopyBackend();
         currentPosition++;
         if (currentPosition >= genomicData.length()) {
             if (hasMoreFiles()) {
@@ -124,6 +514,7 @@ public:
      * @return String con el k-mer extraído, o string vacío si no hay más k-mers en ningún archivo
      */
     std::string getNextKmer(int k) {
+        requireCopyBackend();
         if (k <= 0) {
             throw std::invalid_argument("El valor de k debe ser mayor que 0");
         }
@@ -166,6 +557,7 @@ public:
      * @return Longitud en nucleótidos
      */
     size_t getSequenceLength() const {
+        requireCopyBackend();
         return genomicData.length();
     }
 
@@ -176,6 +568,7 @@ public:
      * @return true si hay más k-mers, false en caso contrario
      */
     bool hasMoreKmers(int k) const {
+        requireCopyBackend();
         // Hay k-mers en el archivo actual
         if (currentPosition + k <= genomicData.length()) {
             return true;
@@ -191,6 +584,7 @@ public:
      * @return String con el fragmento solicitado
      */
     std::string getSequenceFragment(size_t start, size_t length) const {
+        requireCopyBackend();
         if (start + length > genomicData.length()) {
             throw std::out_of_range("El fragmento solicitado excede la longitud de la secuencia");
         }
@@ -204,6 +598,8 @@ public:
         std::cout << "=== Información del archivo FASTA ===" << std::endl;
         std::cout << "Archivo actual: " << currentFilename << std::endl;
         std::cout << "Archivo " << (currentFileIndex + 1) << " de " << fastaFiles.size() << std::endl;
+        // Con los otros backends la secuencia no se copia en memoria
+        if (backend != ReaderBackend::COPY) return;
         std::cout << "Longitud de la secuencia: " << genomicData.length() << " nucleótidos" << std::endl;
         std::cout << "Posición actual: " << currentPosition << std::endl;
         std::cout << "Primeros 50 nucleótidos: " << genomicData.substr(0, 50) << "..." << std::endl;
@@ -249,6 +645,15 @@ public:
         return currentFileIndex;
     }
 
+    /**
+     * Obtiene el número de la lectura FASTQ a la que pertenece el último fragmento entregado
+     * por nextFragment. Es 0 en los archivos FASTA y con el backend COPY, donde las lecturas
+     * ya vienen separadas por una 'N'
+     */
+    size_t getCurrentRecord() const {
+        return scanner.record;
+    }
+
     /**
      * Obtiene el nombre del archivo actual
      */
@@ -29,12 +29,16 @@ uint64_t getCanonicalKmerBits(uint64_t kmer, int k) {
     return std::min(kmer, revComp);
 }
 
-// Función para obtener los k-mers a partir de las lecturas en la carpeta indicada (sin ordenar)
-std::vector<std::pair<uint64_t, size_t>> procesarKMers(std::string folder, int k) {
+// Función para obtener los k-mers a partir de las lecturas en la carpeta indicada (sin ordenar).
+// Por defecto los archivos se leen por bloques de blockSize bytes, por lo que la memoria usada
+// en la lectura no depende del tamaño de los archivos
+std::vector<std::pair<uint64_t, size_t>> procesarKMers(std::string folder, int k,
+        ReaderBackend backend = ReaderBackend::STREAM, size_t blockSize = LectorGenomas::DEFAULT_BLOCK_SIZE) {
     if (k > 31) throw std::runtime_error("K demasiado grande para uint64_t (max 31)");
     std::cout << "\n=== Lectura de archivos iniciada ===" << std::endl;
 
-    LectorGenomas reader(folder);
+    // El siguiente archivo se prepara en segundo plano mientras se recorre el actual
+    LectorGenomas reader(folder, backend, blockSize, true);
     std::unordered_map<uint64_t, uint64_t> kmers_frequency;
     
     uint64_t currentKmer = 0;
@@ -49,44 +53,48 @@ std::vector<std::pair<uint64_t, size_t>> procesarKMers(std::string folder, int k
     std::cout << "=== Iniciando procesamiento de k-mers (k=" << k << ") ===" << std::endl;
     std::cout << "Leyendo archivos del directorio 'Genomas'..." << std::endl;
     
-    // Iteramos usando lógica de sliding window (ventana deslizante)
-    // Esto evita substr() y re-leer strings.
-    while (reader.hasMoreKmers(1)) { // Chequeamos si queda al menos 1 base
-        char base = reader.getBaseAt(reader.getCurrentPosition());
-        uint64_t val = charToBits(base);
-
-        reader.advancePosition(); // Avanzar manualmente
-
-        if (val > 3) { 
-            // Base inválida (N o similar), reiniciar ventana
+    // Iteramos usando lógica de sliding window (ventana deslizante) sobre los fragmentos
+    // de secuencia, que ya vienen sin saltos de línea ni cabeceras
+    std::string_view fragment;
+    size_t fileIndex = reader.getCurrentFileIndex();
+    size_t record = reader.getCurrentRecord();
+    while (reader.nextFragment(fragment)) {
+        // Si cambiamos de archivo o de lectura FASTQ debemos reiniciar la ventana porque los
+        // k-mers no cruzan archivos ni lecturas
+        if (reader.getCurrentFileIndex() != fileIndex || reader.getCurrentRecord() != record) {
+            fileIndex = reader.getCurrentFileIndex();
+            record = reader.getCurrentRecord();
             basesInWindow = 0;
             currentKmer = 0;
-            continue;
         }
 
-        // Shift a la izquierda y añadir nueva base
-        currentKmer = ((currentKmer << 2) | val) & mask;
-        basesInWindow++;
-
-        if (basesInWindow >= k) {
-            // Tenemos un k-mer válido en currentKmer
-            uint64_t canonical = getCanonicalKmerBits(currentKmer, k);
-            kmers_frequency[canonical]++;
-            // --- BLOQUE DE IMPRESIÓN DE PROGRESO ---
-            total_processed++;
-            if (total_processed % PRINT_INTERVAL == 0) {
-                std::cout << "\r[Progreso] Procesados: " << (total_processed / 1000000) << "M"
-                          << " | Unicos: " << kmers_frequency.size()
-                          << " | Archivo: " << reader.getCurrentFilename() 
-                          << "          " << std::flush; // Espacios extra para limpiar residuos visuales
+        for (char base : fragment) {
+            uint64_t val = charToBits(base);
+
+            if (val > 3) { 
+                // Base inválida (N o similar), reiniciar ventana
+                basesInWindow = 0;
+                currentKmer = 0;
+                continue;
+            }
+
+            // Shift a la izquierda y añadir nueva base
+            currentKmer = ((currentKmer << 2) | val) & mask;
+            basesInWindow++;
+
+            if (basesInWindow >= k) {
+                // Tenemos un k-mer válido en currentKmer
+                uint64_t canonical = getCanonicalKmerBits(currentKmer, k);
+                kmers_frequency[canonical]++;
+                // --- BLOQUE DE IMPRESIÓN DE PROGRESO ---
+                total_processed++;
+                if (total_processed % PRINT_INTERVAL == 0) {
+                    std::cout << "\r[Progreso] Procesados: " << (total_processed / 1000000) << "M"
+                              << " | Unicos: " << kmers_frequency.size()
+                              << " | Archivo: " << reader.getCurrentFilename() 
+                              << "          " << std::flush; // Espacios extra para limpiar residuos visuales
+                }
             }
-        }
-        
-        // Si cambiamos de archivo, reader.advancePosition() lo maneja, 
-        // pero debemos reiniciar la ventana porque los k-mers no cruzan archivos
-        if (reader.getCurrentPosition() == 0) {
-            basesInWindow = 0;
-            currentKmer = 0;
         }
     }
 
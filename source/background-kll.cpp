@@ -0,0 +1,194 @@
+#ifndef BACKGROUND_KLL_CPP
+#define BACKGROUND_KLL_CPP
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "cooled-kll.cpp"
+
+
+/**
+ * Runs the compactions of a Cooled-KLL (CooledKLL or ShardedCooledKLL) on a background
+ * thread. Inserts only append to one of two input buffers; when it fills up the buffers are
+ * swapped and a worker hands the full one to the sketch's insert_batch, which sorts and
+ * compacts, while the producer keeps filling the other one. An insert only waits if it fills
+ * its buffer before the worker is done with the previous one.
+ *
+ * Queries first hand the pending inserts to the worker and wait for it, so they see every
+ * insert made before them. The sketch is created by the caller, as in HybridSketch, and must
+ * outlive this object; it must not be used directly while this object exists. The object is
+ * neither copyable nor movable, since the worker keeps a reference to it.
+ */
+template <typename Sketch, typename T = int_t>
+class BackgroundKLL{
+private:
+    Sketch& sketch;
+    // filling belongs to the producer; compacting to the worker while busy is true
+    std::vector<std::pair<T, size_t>> filling, compacting;
+    size_t buffer_capacity;
+    std::mutex mutex;
+    std::condition_variable work_ready, work_done;
+    bool busy, stopping;
+    std::thread worker;
+
+    static constexpr size_t DEFAULT_BUFFER = 4096;
+public:
+    /**
+     * @brief Construct a wrapper that compacts the given sketch in the background.
+     *
+     * @param sketch Sketch that receives the inserts.
+     * @param buffer_capacity Inserts gathered in a buffer before handing it to the worker.
+     */
+    BackgroundKLL(Sketch& sketch, size_t buffer_capacity = DEFAULT_BUFFER) : sketch(sketch){
+        start(buffer_capacity);
+    }
+
+    BackgroundKLL(const BackgroundKLL&) = delete;
+    BackgroundKLL& operator=(const BackgroundKLL&) = delete;
+
+    /**
+     * @brief Hands the pending inserts to the sketch and stops the worker.
+     */
+    ~BackgroundKLL(){
+        flush();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work_ready.notify_one();
+        worker.join();
+    }
+
+    /**
+     * @brief Insert an element, or multiple times an element, into the sketch.
+     *
+     * @param element Element to insert.
+     * @param frequency Times the element must be inserted.
+     */
+    void insert(T element, size_t frequency = 1){
+        filling.push_back(std::make_pair(element, frequency));
+        if (filling.size() >= buffer_capacity) handOff();
+    }
+
+    /**
+     * @brief Inserts a batch of elements, in order, as insert.
+     *
+     * @param elements Elements to insert.
+     */
+    void insert_batch(std::span<const T> elements){
+        for (size_t i=0 ; i<elements.size() ; i++) insert(elements[i]);
+    }
+
+    /**
+     * @brief Inserts a batch of elements with their frequencys, in order, as insert.
+     *
+     * @param elements Pairs (element, frequency) to insert.
+     */
+    void insert_batch(std::span<const std::pair<T, size_t>> elements){
+        for (size_t i=0 ; i<elements.size() ; i++) insert(elements[i].first, elements[i].second);
+    }
+
+    /**
+     * @brief Inserts the element that element(item) gives for every item, as insert.
+     *
+     * @param items Items to insert.
+     * @param element Callable returning the element to insert for an item.
+     */
+    template <typename Item, typename Element>
+    void insert_batch(std::span<Item> items, Element element){
+        for (size_t i=0 ; i<items.size() ; i++) insert(static_cast<T>(element(items[i])));
+    }
+
+    /**
+     * @brief Waits until every insert made so far is in the KLL.
+     */
+    void flush(){
+        if (not filling.empty()) handOff();
+        std::unique_lock<std::mutex> lock(mutex);
+        work_done.wait(lock, [this]{ return not busy; });
+    }
+
+    size_t rank(T element){
+        flush();
+        return sketch.rank(element);
+    }
+
+    T quantile(float delta){
+        flush();
+        return sketch.quantile(delta);
+    }
+
+    std::vector<size_t> ranks(std::span<const T> elements){
+        flush();
+        return sketch.ranks(elements);
+    }
+
+    std::vector<T> quantiles(std::span<const double> deltas){
+        flush();
+        return sketch.quantiles(deltas);
+    }
+
+    const Summary<T>& getSummary(){
+        flush();
+        return sketch.getSummary();
+    }
+
+    /**
+     * @brief Determines used memory of the object, counting the sketch and both buffers.
+     *
+     * @return size_t: used memory in bytes.
+     */
+    size_t memory(){
+        flush();
+        return sketch.memory() + sizeof(*this)
+            + (filling.capacity() + compacting.capacity()) * sizeof(std::pair<T, size_t>);
+    }
+
+private:
+    void start(size_t buffer_capacity){
+        if (buffer_capacity == 0){
+            throw std::invalid_argument("buffer_capacity must be greater than 0");
+        }
+        this->buffer_capacity = buffer_capacity;
+        this->busy = false;
+        this->stopping = false;
+        filling.reserve(buffer_capacity);
+        compacting.reserve(buffer_capacity);
+        worker = std::thread([this]{ work(); });
+    }
+
+    /**
+     * @brief Gives the filled buffer to the worker, waiting for it to finish the previous one.
+     */
+    void handOff(){
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            work_done.wait(lock, [this]{ return not busy; });
+            std::swap(filling, compacting);
+            busy = true;
+        }
+        work_ready.notify_one();
+    }
+
+    /**
+     * @brief Loop of the worker: inserts every buffer it receives into the sketch.
+     */
+    void work(){
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true){
+            work_ready.wait(lock, [this]{ return busy or stopping; });
+            if (not busy) return;
+            lock.unlock();
+
+            sketch.insert_batch(std::span<const std::pair<T, size_t>>(compacting));
+            compacting.clear();
+
+            lock.lock();
+            busy = false;
+            work_done.notify_all();
+        }
+    }
+};
+
+#endif
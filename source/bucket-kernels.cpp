@@ -0,0 +1,116 @@
+#ifndef BUCKET_KERNELS_CPP
+#define BUCKET_KERNELS_CPP
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+#if (defined(__x86_64__) or defined(__i386__)) and defined(__GNUC__)
+#define BUCKET_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Kernels over a hot filter bucket: the probe for a key among its 64-bit items and the
+ * search of the entry with the minimum 16-bit counter. Every instruction set gets its own
+ * version and the best one supported by the running CPU is chosen once, at startup.
+ */
+struct BucketKernels{
+    // Index of the first word equal to key, or size if there is none.
+    size_t (*find)(const uint64_t* words, size_t size, uint64_t key);
+    // Index of the first minimum counter, or 0 if size is 0.
+    size_t (*find_minimum)(const uint16_t* counters, size_t size);
+    const char* name;
+};
+
+inline size_t findScalar(const uint64_t* words, size_t size, uint64_t key){
+    for (size_t i=0 ; i<size ; i++){
+        if (words[i] == key) return i;
+    }
+    return size;
+}
+
+inline size_t findMinimumScalar(const uint16_t* counters, size_t size){
+    size_t lowest_idx = 0, min = SIZE_MAX;
+    for (size_t i=0 ; i<size ; i++){
+        if (counters[i] < min){
+            min = counters[i];
+            lowest_idx = i;
+        }
+    }
+    return lowest_idx;
+}
+
+#ifdef BUCKET_KERNELS_X86
+
+__attribute__((target("sse4.2")))
+inline size_t findSse42(const uint64_t* words, size_t size, uint64_t key){
+    __m128i needle = _mm_set1_epi64x(static_cast<long long>(key));
+    size_t i = 0;
+    for ( ; i + 2 <= size ; i += 2){
+        __m128i equal = _mm_cmpeq_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i*>(words + i)), needle);
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(equal));
+        if (mask != 0) return i + std::countr_zero(static_cast<unsigned>(mask));
+    }
+    for ( ; i<size ; i++){
+        if (words[i] == key) return i;
+    }
+    return size;
+}
+
+/**
+ * @brief Finds the minimum counter eight at a time with PHMINPOSUW, which gives the minimum
+ * of eight 16-bit words and its first position in one instruction.
+ */
+__attribute__((target("sse4.2")))
+inline size_t findMinimumSse42(const uint16_t* counters, size_t size){
+    size_t lowest_idx = 0, min = SIZE_MAX, i = 0;
+    for ( ; i + 8 <= size ; i += 8){
+        __m128i found = _mm_minpos_epu16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(counters + i)));
+        size_t value = static_cast<size_t>(_mm_extract_epi16(found, 0));
+        if (value < min){
+            min = value;
+            lowest_idx = i + static_cast<size_t>(_mm_extract_epi16(found, 1));
+        }
+    }
+    for ( ; i<size ; i++){
+        if (counters[i] < min){
+            min = counters[i];
+            lowest_idx = i;
+        }
+    }
+    return lowest_idx;
+}
+
+__attribute__((target("avx2")))
+inline size_t findAvx2(const uint64_t* words, size_t size, uint64_t key){
+    __m256i needle = _mm256_set1_epi64x(static_cast<long long>(key));
+    size_t i = 0;
+    for ( ; i + 4 <= size ; i += 4){
+        __m256i equal = _mm256_cmpeq_epi64(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i)), needle);
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(equal));
+        if (mask != 0) return i + std::countr_zero(static_cast<unsigned>(mask));
+    }
+    for ( ; i<size ; i++){
+        if (words[i] == key) return i;
+    }
+    return size;
+}
+
+#endif
+
+/**
+ * @brief Chooses the kernels for the instruction sets of the running CPU.
+ */
+inline BucketKernels selectBucketKernels(){
+#ifdef BUCKET_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return {findAvx2, findMinimumSse42, "avx2"};
+    if (__builtin_cpu_supports("sse4.2")) return {findSse42, findMinimumSse42, "sse4.2"};
+#endif
+    return {findScalar, findMinimumScalar, "scalar"};
+}
+
+inline const BucketKernels BUCKET_KERNELS = selectBucketKernels();
+
+#endif
@@ -1,25 +1,48 @@
+#ifndef COOLED_KLL_CPP
+#define COOLED_KLL_CPP
+
 #include "kll.cpp"
+#include "bucket-kernels.cpp"
 
 
+/**
+ * Cooled-KLL sketch over items of type T: a hot filter of NBuckets buckets with BucketCap
+ * entries each in front of a KLL<T, K, C>. With NBuckets = 0 every parameter is given to
+ * the constructor; otherwise all of them are fixed at compile time.
+ */
+template <typename T = int_t, size_t NBuckets = 0, size_t BucketCap = 0, int K = 0, float C = 0.0f>
 class CooledKLL{
-    enum Component{
-        HOT_FILTER = 1,
-        CLASIC_KLL = 2
-    };
+    static_assert((NBuckets == 0) == (BucketCap == 0) and (NBuckets == 0) == (K == 0),
+        "the parameters must be all fixed or all given at runtime");
 
+    /**
+     * View of one bucket of the hot filter. A bucket is a block of whole cache lines holding a
+     * 16-byte header (overflow slot, vote, number of used entries and promoted entry), its
+     * items and a 16-bit counter with the frequency of each item.
+     *
+     * A counter saturates at COUNTER_LIMIT - 1. The first entry of the bucket that goes past
+     * it is promoted: its counter is set to COUNTER_LIMIT and its frequency moves to the
+     * overflow slot. Any other entry that saturates keeps half a counter and the rest of its
+     * frequency goes to the KLL (see setFrequency).
+     */
     class Bucket{
     public:
-        std::vector<int_t> items;
-        std::vector<size_t> frequencys;
-        size_t vote, capacity;
-        
-        Bucket(size_t capacity) :
-            items(std::vector<int_t>()),
-            frequencys(std::vector<size_t>())
-        {
-            this->capacity = capacity;
-            this->vote = 0;        
-        }
+        uint64_t& overflow;
+        uint32_t& vote;
+        uint16_t& size;
+        // Index + 1 of the entry that uses the overflow slot, 0 if none does
+        uint16_t& promoted;
+        T* items;
+        uint16_t* counters;
+
+        Bucket(unsigned char* block, size_t capacity) :
+            overflow(*reinterpret_cast<uint64_t*>(block)),
+            vote(*reinterpret_cast<uint32_t*>(block + 8)),
+            size(*reinterpret_cast<uint16_t*>(block + 12)),
+            promoted(*reinterpret_cast<uint16_t*>(block + 14)),
+            items(reinterpret_cast<T*>(block + BUCKET_HEADER)),
+            counters(reinterpret_cast<uint16_t*>(block + countersOffset(capacity)))
+        {}
 
         /**
          * @brief Find the position of element in items's vector if it exists.
@@ -27,56 +50,127 @@ class CooledKLL{
          * @param element Element to find.
          * @return size_t Position of the element in items or -1 if element is not present.
          */
-        std::pair<size_t,bool> find(int_t element){
-            size_t items_size = items.size();
-            for (size_t i=0 ; i<items_size ; i++){
+        std::pair<size_t,bool> find(T element){
+            if constexpr (WORD_ITEMS){
+                size_t i = BUCKET_KERNELS.find(reinterpret_cast<const uint64_t*>(items), size, static_cast<uint64_t>(element));
+                return std::make_pair(i == size ? 0 : i, i != size);
+            }
+            for (size_t i=0 ; i<size ; i++){
                 if (items[i] == element) return std::make_pair(i, true);
             }
             return std::make_pair(0, false);
         }
 
         /**
-         * @brief Find the element with the minimum frequency.
+         * @brief Find the element with the minimum frequency. The promoted entry has the
+         * largest counter, so the counters alone decide it.
          * 
          * @return size_t Index of the element.
          */
         size_t find_minimum(){
-            size_t lowest_idx, min = UINT64_MAX;
-            size_t entry_size = items.size();
-            for (size_t i=0 ; i<entry_size ; i++){
-                if (frequencys[i] < min){
-                    min = frequencys[i];
-                    lowest_idx = i;
+            return BUCKET_KERNELS.find_minimum(counters, size);
+        }
+
+        /**
+         * @brief Frequency of the i-th entry.
+         */
+        size_t frequency(size_t i) const{
+            return promoted == i + 1 ? overflow : counters[i];
+        }
+
+        /**
+         * @brief Sets the frequency of the i-th entry.
+         * 
+         * @return size_t Part of the frequency that the entry could not keep.
+         */
+        size_t setFrequency(size_t i, size_t frequency){
+            if (promoted == i + 1){
+                if (frequency >= COUNTER_LIMIT){
+                    overflow = frequency;
+                    return 0;
                 }
+                promoted = 0;
+            }
+            if (frequency < COUNTER_LIMIT){
+                counters[i] = static_cast<uint16_t>(frequency);
+                return 0;
             }
-            return lowest_idx;
+            if (promoted == 0){
+                promoted = static_cast<uint16_t>(i + 1);
+                overflow = frequency;
+                counters[i] = COUNTER_LIMIT;
+                return 0;
+            }
+            // Keeps half a counter, so the entry stays heavy and spills again only after
+            // as many inserts
+            counters[i] = COUNTER_LIMIT / 2;
+            return frequency - COUNTER_LIMIT / 2;
         }
 
         /**
-         * @brief Determines used memory by the object.
-         * 
-         * @return size_t: used memory in bytes.
+         * @brief Adds to the frequency of the i-th entry, as setFrequency.
+         */
+        size_t addFrequency(size_t i, size_t frequency){
+            // Common case: the counter has room left
+            if (frequency < static_cast<size_t>(COUNTER_LIMIT - 1 - counters[i]) and counters[i] < COUNTER_LIMIT){
+                counters[i] += static_cast<uint16_t>(frequency);
+                return 0;
+            }
+            return setFrequency(i, this->frequency(i) + frequency);
+        }
+
+        /**
+         * @brief Adds votes to the bucket, saturating its counter.
          */
-        size_t memory(){
-            size_t memory_used = 0;
+        void addVotes(size_t votes){
+            vote = static_cast<uint32_t>(std::min<size_t>(static_cast<size_t>(vote) + votes, UINT32_MAX));
+        }
+    };
 
-            // used memory by the items in containers.
-            memory_used += items.size() * sizeof(int_t);
-            memory_used += frequencys.size() * sizeof(size_t);
+    static_assert(std::is_trivially_copyable_v<T>, "the hot filter stores the items as raw memory");
+    static_assert(alignof(T) <= 16, "the items of a bucket start 16 bytes into it");
 
-            // static used memory
-            memory_used += sizeof(*this);
+    // 64-bit integer items are probed with the vectorized kernels of bucket-kernels.cpp
+    static constexpr bool WORD_ITEMS = std::is_integral_v<T> and sizeof(T) == sizeof(uint64_t);
 
-            return memory_used;
-        }
-        
+    static constexpr size_t CACHE_LINE = 64;
+    static constexpr size_t BUCKET_HEADER = 16;
+    static constexpr uint16_t COUNTER_LIMIT = UINT16_MAX;
+
+    struct alignas(CACHE_LINE) CacheLine{
+        unsigned char bytes[CACHE_LINE];
     };
 
+    /**
+     * @brief Byte offset of the counters inside a bucket with the given capacity.
+     */
+    static constexpr size_t countersOffset(size_t capacity){
+        return BUCKET_HEADER + capacity * sizeof(T);
+    }
+
+    /**
+     * @brief Bytes taken by a bucket with the given capacity, rounded up to whole cache lines.
+     */
+    static constexpr size_t bucketStride(size_t capacity){
+        size_t bytes = countersOffset(capacity) + capacity * sizeof(uint16_t);
+        return (bytes + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    }
+
 private:
-    KLL kll;
-    std::vector<Bucket> buckets;
-    size_t n_buckets;
+    KLL<T, K, C> kll;
+    // Hot filter: n_buckets blocks of bucketStride(capacity) bytes, see Bucket.
+    std::vector<CacheLine> filter;
+    size_t n_buckets, bucket_mask, buckets_capacity;
     int eviction_threshold;
+    // Each element may live in two buckets and new entries go to the less loaded one
+    bool two_choice;
+    // Bytes the hot filter may grow to when it resizes itself, 0 keeps its shape fixed
+    size_t memory_budget;
+    // Inserts and inserts that found their buckets full since the last resize check
+    size_t recent_inserts, recent_misses;
+    // Sorted view of the hot filter and the KLL used by the queries, dropped on every insert.
+    Summary<T> summary;
+    bool summary_valid;
 public:
     /**
      * @brief Construct a new Cooled-KLL object
@@ -86,13 +180,33 @@ public:
      * @param eviction_threshold Threshold to evict an element to the kll component.
      * @param k Capacity of the largest compactor in kll.
      * @param c Compression factor for creating a new compactor in the KLL.
+     * @param seed Seed of the coin flips used by the KLL compactions, fix it to replay a run.
      */
-    CooledKLL(size_t n_buckets, size_t buckets_capacity, int eviction_threshold, int k, float c) : 
-        kll(KLL(k, c)),
-        buckets(std::vector<Bucket>(n_buckets, Bucket(buckets_capacity)))
+    CooledKLL(size_t n_buckets, size_t buckets_capacity, int eviction_threshold, int k, float c,
+        uint64_t seed = std::random_device{}()) requires (NBuckets == 0) : 
+        kll(k, c, seed)
     {
         this->eviction_threshold = eviction_threshold;
-        this->n_buckets = n_buckets;
+        this->two_choice = false;
+        this->memory_budget = 0;
+        allocate(n_buckets, buckets_capacity);
+        this->summary_valid = false;
+    }
+
+    /**
+     * @brief Construct a new Cooled-KLL object with the parameters fixed at compile time.
+     * 
+     * @param eviction_threshold Threshold to evict an element to the kll component.
+     * @param seed Seed of the coin flips used by the KLL compactions, fix it to replay a run.
+     */
+    CooledKLL(int eviction_threshold, uint64_t seed = std::random_device{}()) requires (NBuckets != 0) : 
+        kll(seed)
+    {
+        this->eviction_threshold = eviction_threshold;
+        this->two_choice = false;
+        this->memory_budget = 0;
+        allocate(NBuckets, BucketCap);
+        this->summary_valid = false;
     }
 
     /**
@@ -100,139 +214,315 @@ public:
      * 
      * @param element Element to insert.
      */
-    void insert(int_t element, size_t frequency = 1){
-        size_t bucket_idx = hash(element);
-        std::pair<size_t, bool> pair = buckets[bucket_idx].find(element);
+    void insert(T element, size_t frequency = 1){
+        summary_valid = false;
+        std::pair<size_t, size_t> idx = candidates(element);
+        insertIntoBucket(idx.first, idx.second, element, frequency);
+        if (memory_budget != 0) adapt();
+    }
+
+    /**
+     * @brief Enables or disables the two-choice placement: every element gets a second
+     * candidate bucket, new entries go to the less loaded of both and lookups check both.
+     * It can only be changed while the hot filter is empty.
+     * 
+     * @param enabled Whether the two-choice placement is used.
+     */
+    void setTwoChoice(bool enabled){
+        for (size_t i=0 ; i<n_buckets ; i++){
+            if (bucketAt(i).size != 0){
+                throw std::logic_error("the bucket placement can only change while the hot filter is empty");
+            }
+        }
+        two_choice = enabled;
+    }
+
+    bool getTwoChoice() const{
+        return two_choice;
+    }
+
+    /**
+     * @brief Chooses the ranks answered with the most accuracy by the KLL, see
+     * KLL::setRankAccuracy. Only while the KLL is empty.
+     * 
+     * @param accuracy UNIFORM for the classic KLL, or the tails whose error is relative.
+     */
+    void setRankAccuracy(RankAccuracy accuracy){
+        kll.setRankAccuracy(accuracy);
+    }
+
+    RankAccuracy getRankAccuracy() const{
+        return kll.getRankAccuracy();
+    }
+
+    /**
+     * @brief Lets the hot filter resize itself while ingesting. Every few inserts the share of
+     * them that found their buckets full is checked: above GROW_PRESSURE the number of
+     * buckets doubles, if it still fits in the budget; below SHRINK_PRESSURE, with less than a
+     * quarter of the entries in use, it halves. Resizing rehashes the entries, heaviest first,
+     * and evicts into the KLL the ones that no longer fit. Only for runtime configured sketches.
+     * 
+     * @param bytes Maximum bytes of the hot filter, 0 to keep its current shape.
+     */
+    void setMemoryBudget(size_t bytes) requires (NBuckets == 0){
+        memory_budget = bytes;
+        recent_inserts = 0;
+        recent_misses = 0;
+        if (bytes == 0) return;
+        size_t buckets_fitting = std::max<size_t>(bytes / bucketStride(bucketCapacity()), 1);
+        if (buckets_fitting < n_buckets){
+            resize(buckets_fitting);
+        }
+    }
+
+    size_t getN_buckets() const{
+        return n_buckets;
+    }
+
+    /**
+     * @brief Inserts a batch of elements, in order. The buckets of every block of elements are
+     * hashed and prefetched before probing them, so their cache misses overlap.
+     * 
+     * @param elements Elements to insert.
+     */
+    void insert_batch(std::span<const T> elements){
+        insertBlocks(elements.size(), [&](size_t i){ return elements[i]; }, [](size_t){ return size_t(1); });
+    }
+
+    /**
+     * @brief Inserts a batch of elements with their frequencys, in order, as insert_batch.
+     * 
+     * @param elements Pairs (element, frequency) to insert.
+     */
+    void insert_batch(std::span<const std::pair<T, size_t>> elements){
+        insertBlocks(elements.size(), [&](size_t i){ return elements[i].first; }, [&](size_t i){ return elements[i].second; });
+    }
+
+    /**
+     * @brief Inserts the element that element(item) gives for every item, in order, as
+     * insert_batch. Lets the callers insert one field of their records without copying it.
+     * 
+     * @param items Items to insert.
+     * @param element Callable returning the element to insert for an item.
+     */
+    template <typename Item, typename Element>
+    void insert_batch(std::span<Item> items, Element element){
+        insertBlocks(items.size(), [&](size_t i){ return static_cast<T>(element(items[i])); }, [](size_t){ return size_t(1); });
+    }
+
+private:
+    // Number of elements hashed and prefetched ahead of their probes
+    static constexpr size_t BATCH_BLOCK = 32;
+
+    template <typename Element, typename Frequency>
+    void insertBlocks(size_t count, Element element, Frequency frequency){
+        summary_valid = false;
+        std::pair<size_t, size_t> bucket_idx[BATCH_BLOCK];
+        for (size_t start=0 ; start<count ; start+=BATCH_BLOCK){
+            size_t block = std::min(BATCH_BLOCK, count - start);
+            for (size_t i=0 ; i<block ; i++){
+                bucket_idx[i] = candidates(element(start + i));
+                prefetchBucket(bucket_idx[i].first);
+                if (two_choice) prefetchBucket(bucket_idx[i].second);
+            }
+            for (size_t i=0 ; i<block ; i++){
+                insertIntoBucket(bucket_idx[i].first, bucket_idx[i].second, element(start + i), frequency(start + i));
+            }
+            // Resizing moves the buckets, so it waits until the block is done
+            if (memory_budget != 0) adapt();
+        }
+    }
+
+    /**
+     * @brief Inserts an element into one of its candidate buckets or into the KLL as appropriate.
+     */
+    void insertIntoBucket(size_t first_idx, size_t second_idx, T element, size_t frequency){
+        recent_inserts++;
+        std::pair<size_t, bool> pair;
+        Bucket bucket = locate(first_idx, second_idx, element, pair);
         size_t entry_idx = pair.first;
         // If the element exits in the bucket, increase its frequency by 1
         if (pair.second){
-            buckets[bucket_idx].frequencys[entry_idx] += frequency;
+            addFrequency(bucket, entry_idx, frequency);
             return;
         }
         // If element is not in the bucket, but there is an empty entry, push the pair (element, 1) into an entry.
-        if (buckets[bucket_idx].items.size() < buckets[bucket_idx].capacity){
-            buckets[bucket_idx].items.push_back(element);
-            buckets[bucket_idx].frequencys.push_back(frequency);
+        if (bucket.size < bucketCapacity()){
+            append(bucket, element, frequency);
             return;
         }
         // If element is not in the bucket and there isn't any entry available, increase vote by 1 and continue
-        buckets[bucket_idx].vote += 1;
+        recent_misses++;
+        bucket.addVotes(1);
         
         // Find the minimum element
-        size_t lowest_idx = buckets[bucket_idx].find_minimum();
-        size_t min = buckets[bucket_idx].frequencys[lowest_idx];
+        size_t lowest_idx = bucket.find_minimum();
+        size_t min = bucket.frequency(lowest_idx);
 
         // If vote/min_frequency < eviction_threshold, insert element into KLL.
-        int condition = static_cast<int>(std::round(buckets[bucket_idx].vote/min));
+        int condition = static_cast<int>(std::round(bucket.vote/min));
         if (condition < eviction_threshold){
             kll.insert(element, frequency);
             return;
         // If not, replace minimum frequency element with incoming element and insert the evicted element into KLL
         } else {
-            buckets[bucket_idx].vote = 0;
-            int_t min_element = buckets[bucket_idx].items[lowest_idx];
+            bucket.vote = 0;
+            T min_element = bucket.items[lowest_idx];
             kll.insert(min_element, min);
-            buckets[bucket_idx].items[lowest_idx] = element;
-            buckets[bucket_idx].frequencys[lowest_idx] = frequency;
+            bucket.items[lowest_idx] = element;
+            setFrequency(bucket, lowest_idx, frequency);
             return;
         }
     }
 
+public:
     /**
-     * @brief Estimates the rank of the given element.
+     * @brief Splitmix finalizer used to spread the elements over the buckets.
+     */
+    static uint64_t mix(uint64_t x){
+        x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+        x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+        return x ^ (x >> 31);
+    }
+
+    /**
+     * @brief Merges another Cooled-KLL built with the same parameters into this one. Entries
+     * of the same bucket are combined; when the bucket runs out of entries the lighter item
+     * is evicted into the KLL, which is then merged with the KLL of the other sketch.
      * 
-     * @param element Element to estimate the rank.
-     * @return size_t Amount of elements that are less or equal to element.
+     * @param other Sketch to merge. It is not modified.
      */
-    size_t rank(int_t element){
-        int_t rank = 0;
-        size_t entries_number;
-
-        // Go through each element of the Hot filter to estimate de Hot filter rank
-        size_t buckets_number = buckets.size();
-        for (size_t i=0 ; i<buckets_number ; i++){
-            entries_number = buckets[i].items.size();
-            for (size_t j=0 ; j<entries_number ; j++){
-                if (buckets[i].items[j] <= element){
-                    rank += buckets[i].frequencys[j];
-                }
+    void merge(const CooledKLL& other){
+        if (&other == this){
+            // Merging reads the other sketch while this one grows, so merge a copy of itself
+            CooledKLL copy(other);
+            merge(copy);
+            return;
+        }
+        if (n_buckets != other.n_buckets or bucketCapacity() != other.bucketCapacity()
+            or eviction_threshold != other.eviction_threshold or two_choice != other.two_choice){
+            throw std::invalid_argument("only sketches with the same parameters can be merged");
+        }
+        summary_valid = false;
+
+        for (size_t i=0 ; i<n_buckets ; i++){
+            const Bucket incoming = other.bucketAt(i);
+            bucketAt(i).addVotes(incoming.vote);
+
+            size_t entries = incoming.size;
+            for (size_t j=0 ; j<entries ; j++){
+                T element = incoming.items[j];
+                size_t frequency = incoming.frequency(j);
+
+                placeEntry(element, frequency);
             }
         }
 
-        rank += kll.rank(element);
+        kll.merge(other.kll);
+    }
 
-        return rank;
+    /**
+     * @brief Estimates the rank of the given element.
+     * 
+     * @param element Element to estimate the rank.
+     * @return size_t Amount of elements that are less or equal to element.
+     */
+    size_t rank(T element){
+        return getSummary().rank(element);
     }
 
-    int_t quantile(float delta){
+    /**
+     * @brief Estimates the delta-quantile of the data in the sketch.
+     * 
+     * @param delta Quantile to estimate.
+     * @return T Element that is the delta-quantile of the data.
+     */
+    T quantile(float delta){
         if (delta < 0 or 1 < delta){
             throw std::invalid_argument("delta must belong to [0, 1]");
         }
-        std::vector<std::pair<int_t, size_t>> data_kll = kll.data();
-        std::vector<std::pair<int_t, size_t>> data_hot_filter;
-        size_t quantile_pos = 0;
+        const Summary<T>& elements = getSummary();
+        if (elements.items.empty()){
+            throw std::out_of_range("the sketch is empty");
+        }
+
+        size_t quantile_pos = static_cast<size_t>(std::round(delta * elements.total()));
+        return elements.items[elements.position(quantile_pos)];
+    }
+
+    /**
+     * @brief Estimates the rank of a batch of elements building the summary only once.
+     * 
+     * @param elements Elements to estimate the rank, preferably in ascending order.
+     * @return std::vector<size_t> Amount of elements that are less or equal to each element.
+     */
+    std::vector<size_t> ranks(std::span<const T> elements){
+        return getSummary().rank(elements);
+    }
+
+    /**
+     * @brief Estimates a batch of quantiles building the summary only once.
+     * 
+     * @param deltas Quantiles to estimate, preferably in ascending order.
+     * @return std::vector<T> Element that is each of the quantiles, in the same order.
+     */
+    std::vector<T> quantiles(std::span<const double> deltas){
+        const Summary<T>& elements = getSummary();
+        if (elements.items.empty()){
+            throw std::out_of_range("the sketch is empty");
+        }
+
+        std::vector<size_t> indexes = elements.position(Summary<T>::positions(deltas, elements.total()));
+        std::vector<T> answer(deltas.size());
+        for (size_t q=0 ; q<deltas.size() ; q++){
+            answer[q] = elements.items[indexes[q]];
+        }
+        return answer;
+    }
+
+    /**
+     * @brief Gets the sorted summary of the hot filter and the KLL together, rebuilding it
+     * only if an insertion happened since the last query.
+     * 
+     * @return const Summary<T>& Items of the sketch sorted with their accumulated weights.
+     */
+    const Summary<T>& getSummary(){
+        if (summary_valid) return summary;
+
+        std::vector<std::pair<T, size_t>> data_hot_filter;
 
         // Collect all the elements and its frequencys from the hot filter
-        size_t buckets_number = buckets.size();
-        for (size_t i=0 ; i<buckets_number ; i++){
-            size_t bucket_size = buckets[i].items.size();
-            for (size_t j=0 ; j<bucket_size ; j++){
-                data_hot_filter.push_back(std::make_pair(buckets[i].items[j], buckets[i].frequencys[j]));
-                quantile_pos += buckets[i].frequencys[j];
+        for (size_t i=0 ; i<n_buckets ; i++){
+            const Bucket bucket = bucketAt(i);
+            for (size_t j=0 ; j<bucket.size ; j++){
+                data_hot_filter.push_back(std::make_pair(bucket.items[j], bucket.frequency(j)));
             }
         }
 
         // Sort the created vector
-        std::sort(data_hot_filter.begin(), data_hot_filter.end(), [](const std::pair<int_t, size_t>& a, const std::pair<int_t, size_t>& b){
+        std::sort(data_hot_filter.begin(), data_hot_filter.end(), [](const std::pair<T, size_t>& a, const std::pair<T, size_t>& b){
             return a.first < b.first;
         });
 
-        quantile_pos += kll.getSketch_size();
-        quantile_pos = static_cast<size_t>(std::round(delta * quantile_pos));
-
-        size_t hot_filter_size = data_hot_filter.size(), kll_size = data_kll.size();
-        size_t all_data_size =  hot_filter_size + kll_size;
-        size_t i=0, j=0, count=0;
-        int last_picked = -1;
-        for (size_t x=0; x<all_data_size ; x++){
-            if (count <= quantile_pos){
-                if (i < hot_filter_size and j < kll_size){
-                    if (data_hot_filter[i].first <= data_kll[j].first){
-                        count += data_hot_filter[i].second;
-                        i++;
-                        last_picked = HOT_FILTER;
-                    } else {
-                        count += data_kll[j].second;
-                        j++;
-                        last_picked = CLASIC_KLL;
-                    }
-                } else if (i >= hot_filter_size){
-                    count += data_kll[j].second;
-                    j++;
-                    last_picked = CLASIC_KLL;
-                } else {
-                    count += data_hot_filter[i].second;
-                    i++;
-                    last_picked = HOT_FILTER;
-                }
+        // Merge it with the already sorted items of the KLL
+        const Summary<T>& kll_summary = kll.getSummary();
+        size_t hot_filter_size = data_hot_filter.size(), kll_size = kll_summary.items.size();
+        std::vector<std::pair<T, size_t>> data;
+        data.reserve(hot_filter_size + kll_size);
+        size_t i=0, j=0;
+        while (i < hot_filter_size or j < kll_size){
+            if (j >= kll_size or (i < hot_filter_size and data_hot_filter[i].first <= kll_summary.items[j])){
+                data.push_back(data_hot_filter[i]);
+                i++;
             } else {
-                if (last_picked == HOT_FILTER){
-                    return data_hot_filter[i-1].first;
-                }
-                if (last_picked == CLASIC_KLL){
-                    return data_kll[j-1].first;
-                }
-                if (data_hot_filter[0].first <= data_kll[0].first){
-                    return data_hot_filter[0].first;
-                }
-                return data_kll[0].first;
+                data.push_back(std::make_pair(kll_summary.items[j], kll_summary.ranks[j] - (j == 0 ? 0 : kll_summary.ranks[j-1])));
+                j++;
             }
         }
-        if (last_picked == HOT_FILTER){
-            return data_hot_filter[hot_filter_size-1].first;
-        }
-        return data_kll[kll_size-1].first;
-        
+
+        summary.build(data);
+        summary_valid = true;
+        return summary;
     }
 
     /**
@@ -241,12 +531,10 @@ public:
      * @return size_t: used memory in bytes.
      */
     size_t memory(){
-        size_t memory_used = kll.memory(), hot_filter_size = buckets.size();
+        size_t memory_used = kll.memory();
 
         // used memory by the buckets and its elements.
-        for (uint32_t i=0 ; i<hot_filter_size ; i++){
-            memory_used += buckets[i].memory() + sizeof(buckets[i]);
-        }
+        memory_used += filter.size() * sizeof(CacheLine);
 
         // used static memory
         memory_used += sizeof(*this);
@@ -254,16 +542,321 @@ public:
         return memory_used;
     }
 
+    /**
+     * @brief Saves the sketch into a binary snapshot (see snapshot.cpp). The file can be
+     * restored with load or queried in place with SketchSnapshot.
+     * 
+     * @param path Path to the snapshot, overwritten if it exists.
+     */
+    void save(const std::string& path){
+        SnapshotWriter writer(path);
+        writer.header(SNAPSHOT_COOLED_KLL);
+        writer.summary(getSummary());
+        writer.headerField(3, writer.position());
+        kll.writeSnapshot(writer);
+
+        // Hot filter, every bucket padded to its capacity
+        size_t capacity = bucketCapacity();
+        writer.headerField(4, writer.position());
+        writer.headerField(5, two_choice ? SNAPSHOT_TWO_CHOICE : 0);
+        writer.word(n_buckets);
+        writer.word(capacity);
+        writer.word(static_cast<uint64_t>(static_cast<int64_t>(eviction_threshold)));
+        for (size_t i=0 ; i<n_buckets ; i++) writer.word(bucketAt(i).vote);
+        for (size_t i=0 ; i<n_buckets ; i++) writer.word(bucketAt(i).size);
+        for (size_t i=0 ; i<n_buckets ; i++){
+            Bucket bucket = bucketAt(i);
+            writer.words(bucket.items, bucket.size);
+            for (size_t j=bucket.size ; j<capacity ; j++) writer.word(0);
+        }
+        for (size_t i=0 ; i<n_buckets ; i++){
+            Bucket bucket = bucketAt(i);
+            for (size_t j=0 ; j<bucket.size ; j++) writer.word(bucket.frequency(j));
+            for (size_t j=bucket.size ; j<capacity ; j++) writer.word(0);
+        }
+        writer.close();
+    }
+
+    /**
+     * @brief Replaces the content of the sketch with a snapshot saved by CooledKLL::save.
+     * A sketch with fixed parameters only loads snapshots saved with the same ones.
+     * 
+     * @param path Path to the snapshot.
+     */
+    void load(const std::string& path){
+        MappedFile file(path);
+        SnapshotReader reader(file);
+        if (reader.header() != SNAPSHOT_COOLED_KLL){
+            throw std::runtime_error("the snapshot does not hold a Cooled-KLL: " + path);
+        }
+        uint64_t hot_filter_offset = reader.headerField(4);
+        uint64_t flags = reader.headerField(5);
+        reader.seek(reader.headerField(3));
+        kll.readSnapshot(reader);
+
+        reader.seek(hot_filter_offset);
+        size_t saved_buckets = reader.word(), capacity = reader.word();
+        int saved_threshold = static_cast<int>(static_cast<int64_t>(reader.word()));
+        if (saved_buckets == 0 or saved_buckets > file.size() or capacity > file.size()){
+            throw std::runtime_error("the snapshot has an invalid hot filter");
+        }
+        if constexpr (NBuckets != 0){
+            if (saved_buckets != NBuckets or capacity != BucketCap){
+                throw std::runtime_error("the snapshot was saved with other hot filter parameters");
+            }
+        }
+        eviction_threshold = saved_threshold;
+        allocate(saved_buckets, capacity);
+        two_choice = (flags & SNAPSHOT_TWO_CHOICE) != 0;
+
+        for (size_t i=0 ; i<n_buckets ; i++) bucketAt(i).addVotes(reader.word());
+        for (size_t i=0 ; i<n_buckets ; i++){
+            size_t count = reader.word();
+            if (count > capacity) throw std::runtime_error("the snapshot has an invalid hot filter");
+            bucketAt(i).size = count;
+        }
+        for (size_t i=0 ; i<n_buckets ; i++){
+            Bucket bucket = bucketAt(i);
+            reader.words(bucket.items, bucket.size);
+            for (size_t j=bucket.size ; j<capacity ; j++) reader.word();
+        }
+        for (size_t i=0 ; i<n_buckets ; i++){
+            Bucket bucket = bucketAt(i);
+            for (size_t j=0 ; j<bucket.size ; j++) setFrequency(bucket, j, reader.word());
+            for (size_t j=bucket.size ; j<capacity ; j++) reader.word();
+        }
+        summary_valid = false;
+    }
+
 private:
     size_t hash(size_t x) {
-        x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
-        x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
-        x = x ^ (x >> 31);
+        x = mix(x);
+        if constexpr (NBuckets != 0) return (x % NBuckets);
+        if (bucket_mask != 0) return (x & bucket_mask);
         return (x % n_buckets);
     }
-    
+
+    /**
+     * @brief Candidate buckets of an element. The first one is hash(element); with the
+     * two-choice placement the second one comes from the high bits of the same hash,
+     * otherwise both are the same.
+     */
+    std::pair<size_t, size_t> candidates(T element){
+        size_t first = hash(static_cast<size_t>(element));
+        if (not two_choice) return std::make_pair(first, first);
+        uint64_t high = mix(static_cast<uint64_t>(element)) >> 32;
+        return std::make_pair(first, static_cast<size_t>((high * n_buckets) >> 32));
+    }
+
+    /**
+     * @brief Finds the candidate bucket that holds element. If none does, gives the less
+     * loaded one, or when both are full the one with the lighter minimum, which takes the
+     * vote.
+     * 
+     * @param pair Set to the position of element in the bucket and whether it was found.
+     */
+    Bucket locate(size_t first_idx, size_t second_idx, T element, std::pair<size_t, bool>& pair) const{
+        Bucket first = bucketAt(first_idx);
+        pair = first.find(element);
+        if (pair.second or first_idx == second_idx) return first;
+
+        Bucket second = bucketAt(second_idx);
+        std::pair<size_t, bool> in_second = second.find(element);
+        if (in_second.second){
+            pair = in_second;
+            return second;
+        }
+        if (first.size != second.size) return first.size < second.size ? first : second;
+        if (first.size < bucketCapacity()) return first;
+        return second.frequency(second.find_minimum()) < first.frequency(first.find_minimum()) ? second : first;
+    }
+
+    /**
+     * @brief Sets the frequency of an entry, inserting into the KLL the part that its counter
+     * cannot hold.
+     */
+    void setFrequency(Bucket& bucket, size_t i, size_t frequency){
+        size_t spill = bucket.setFrequency(i, frequency);
+        if (spill != 0) kll.insert(bucket.items[i], spill);
+    }
+
+    void addFrequency(Bucket& bucket, size_t i, size_t frequency){
+        size_t spill = bucket.addFrequency(i, frequency);
+        if (spill != 0) kll.insert(bucket.items[i], spill);
+    }
+
+    /**
+     * @brief Stores element in the next empty entry of the bucket.
+     */
+    void append(Bucket& bucket, T element, size_t frequency){
+        bucket.items[bucket.size] = element;
+        bucket.size++;
+        setFrequency(bucket, bucket.size - 1, frequency);
+    }
+
+    /**
+     * @brief Adds an entry to the hot filter without voting: if its buckets are full the
+     * lighter of the entry and the bucket minimum is evicted into the KLL.
+     */
+    void placeEntry(T element, size_t frequency){
+        std::pair<size_t, size_t> idx = candidates(element);
+        std::pair<size_t, bool> pair;
+        Bucket bucket = locate(idx.first, idx.second, element, pair);
+        if (pair.second){
+            addFrequency(bucket, pair.first, frequency);
+        } else if (bucket.size < bucketCapacity()){
+            append(bucket, element, frequency);
+        } else {
+            // Keeps the heavier item in the bucket and evicts the other one
+            size_t lowest_idx = bucket.find_minimum();
+            if (bucket.frequency(lowest_idx) < frequency){
+                kll.insert(bucket.items[lowest_idx], bucket.frequency(lowest_idx));
+                bucket.items[lowest_idx] = element;
+                setFrequency(bucket, lowest_idx, frequency);
+            } else {
+                kll.insert(element, frequency);
+            }
+        }
+    }
+
+    // Share of inserts finding their buckets full above which the hot filter grows, and
+    // below which it may shrink
+    static constexpr double GROW_PRESSURE = 0.02;
+    static constexpr double SHRINK_PRESSURE = 0.01;
+    // Inserts between resize checks, per entry of the hot filter
+    static constexpr size_t ADAPT_INTERVAL = 4;
+
+    /**
+     * @brief Grows or shrinks the hot filter following the pressure of the recent inserts.
+     */
+    void adapt(){
+        size_t entries = n_buckets * bucketCapacity();
+        if (recent_inserts < ADAPT_INTERVAL * entries) return;
+
+        double pressure = static_cast<double>(recent_misses) / recent_inserts;
+        recent_inserts = 0;
+        recent_misses = 0;
+        if (pressure > GROW_PRESSURE){
+            if (2 * n_buckets * bucketStride(bucketCapacity()) <= memory_budget) resize(2 * n_buckets);
+        } else if (pressure < SHRINK_PRESSURE and n_buckets > 1){
+            size_t used = 0;
+            for (size_t i=0 ; i<n_buckets ; i++) used += bucketAt(i).size;
+            if (4 * used < entries) resize(n_buckets / 2);
+        }
+    }
+
+    /**
+     * @brief Rehashes the hot filter into the given number of buckets. The votes start over.
+     */
+    void resize(size_t new_buckets){
+        std::vector<std::pair<T, size_t>> entries;
+        for (size_t i=0 ; i<n_buckets ; i++){
+            const Bucket bucket = bucketAt(i);
+            for (size_t j=0 ; j<bucket.size ; j++){
+                entries.push_back(std::make_pair(bucket.items[j], bucket.frequency(j)));
+            }
+        }
+        std::stable_sort(entries.begin(), entries.end(), [](const std::pair<T, size_t>& a, const std::pair<T, size_t>& b){
+            return a.second > b.second;
+        });
+
+        allocate(new_buckets, bucketCapacity());
+        for (size_t i=0 ; i<entries.size() ; i++){
+            placeEntry(entries[i].first, entries[i].second);
+        }
+        summary_valid = false;
+    }
+
+    /**
+     * @brief Number of entries of every bucket.
+     */
+    size_t bucketCapacity() const{
+        if constexpr (BucketCap != 0) return BucketCap;
+        return buckets_capacity;
+    }
+
+    /**
+     * @brief View of the i-th bucket of the hot filter.
+     */
+    Bucket bucketAt(size_t i) const{
+        size_t capacity = bucketCapacity();
+        const unsigned char* block = reinterpret_cast<const unsigned char*>(filter.data()) + i * bucketStride(capacity);
+        return Bucket(const_cast<unsigned char*>(block), capacity);
+    }
+
+    /**
+     * @brief Brings into the cache the lines of the i-th bucket read by its probe: the header
+     * with the first items and the counters.
+     */
+    void prefetchBucket(size_t i) const{
+#ifdef __GNUC__
+        size_t capacity = bucketCapacity();
+        const unsigned char* block = reinterpret_cast<const unsigned char*>(filter.data()) + i * bucketStride(capacity);
+        __builtin_prefetch(block, 1);
+        __builtin_prefetch(block + countersOffset(capacity), 1);
+#endif
+    }
+
+    /**
+     * @brief Allocates an empty hot filter with the given shape.
+     */
+    void allocate(size_t n_buckets, size_t buckets_capacity){
+        if (n_buckets == 0 or buckets_capacity == 0 or buckets_capacity >= UINT16_MAX){
+            throw std::invalid_argument("there must be at least one bucket, with between 1 and 65534 entries");
+        }
+        this->n_buckets = n_buckets;
+        this->buckets_capacity = buckets_capacity;
+        // A power of two number of buckets takes the bucket from the low bits of the hash
+        this->bucket_mask = (NBuckets == 0 and (n_buckets & (n_buckets - 1)) == 0) ? n_buckets - 1 : 0;
+        this->recent_inserts = 0;
+        this->recent_misses = 0;
+        filter.assign(n_buckets * bucketStride(buckets_capacity) / CACHE_LINE, CacheLine{});
+    }
+
 };
 
+/**
+ * @brief Builds a Cooled-KLL with the given parameters and hands it to f. The configurations
+ * used in the experiments are prebuilt with every parameter fixed at compile time; any other
+ * one gets the runtime configured sketch.
+ * 
+ * @param n_buckets Number of buckets in the hot filter.
+ * @param buckets_capacity Number of entries per bucket.
+ * @param eviction_threshold Threshold to evict an element to the kll component.
+ * @param k Capacity of the largest compactor in kll.
+ * @param c Compression factor for creating a new compactor in the KLL.
+ * @param f Callable invoked with the sketch, as f(sketch).
+ * @param seed Seed of the coin flips used by the KLL compactions, fix it to replay a run.
+ */
+template <typename F>
+void withCooledKLL(size_t n_buckets, size_t buckets_capacity, int eviction_threshold, int k, float c, F&& f,
+    uint64_t seed = std::random_device{}()){
+    if (c == 0.7f){
+        if (n_buckets == 100 and buckets_capacity == 10 and k == 100){
+            CooledKLL<int_t, 100, 10, 100, 0.7f> sketch(eviction_threshold, seed);
+            f(sketch);
+            return;
+        }
+        if (n_buckets == 10 and buckets_capacity == 5 and k == 20){
+            CooledKLL<int_t, 10, 5, 20, 0.7f> sketch(eviction_threshold, seed);
+            f(sketch);
+            return;
+        }
+        if (n_buckets == 15 and buckets_capacity == 5 and k == 20){
+            CooledKLL<int_t, 15, 5, 20, 0.7f> sketch(eviction_threshold, seed);
+            f(sketch);
+            return;
+        }
+        if (n_buckets == 20 and buckets_capacity == 5 and k == 20){
+            CooledKLL<int_t, 20, 5, 20, 0.7f> sketch(eviction_threshold, seed);
+            f(sketch);
+            return;
+        }
+    }
+    CooledKLL<> sketch(n_buckets, buckets_capacity, eviction_threshold, k, c, seed);
+    f(sketch);
+}
+
 // int main(){
 //     int num = 3;
 //     float quantile = 0.2;
@@ -278,4 +871,6 @@ private:
 
 //     std::cout << "Rank " << num << ": " << kll.rank(num) << std::endl;
 //     std::cout << "Quantile " << quantile << ": " << quantile_answer << std::endl;
-// }
\ No newline at end of file
+// }
+
+#endif
\ No newline at end of file
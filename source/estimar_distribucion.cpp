@@ -50,14 +50,15 @@ std::vector<std::pair<uint64_t, uint64_t>> leerKmers(const std::string& kmers_pa
 
 int main(int argc, char* argv[]){
     // Verificacion de correctitud en la ejecucion del programa
-    if (argc != 7){
-        std::cerr << "correct usage: ./exe <kmers_file> <k-mers_length> <distribution> <N_buckets> <B_capacity> <C_size>" << std::endl;
+    if (argc != 7 and argc != 8){
+        std::cerr << "correct usage: ./exe <kmers_file> <k-mers_length> <distribution> <N_buckets> <B_capacity> <C_size> [engine]" << std::endl;
         std::cerr << "<kmers_file>: path to the file with the kmers." << std::endl;
         std::cerr << "<k-mers_length>: length of kmers." << std::endl;
         std::cerr << "<distribution>: define type of distribution: 0 = kmers distribution | 1 = frequency distribution." << std::endl;
         std::cerr << "<N_buckets>: number of buckets in the hot filter part of the sketch." << std::endl;
         std::cerr << "<B_capacity>: number of entries a bucket have." << std::endl;
         std::cerr << "<C_size>: number of elements of the largest compactor in the classic kll part." << std::endl;
+        std::cerr << "[engine]: quantile engine: 0 = Cooled-KLL (default) | 1 = logarithmic histogram | 2 = exact histogram that switches to the Cooled-KLL | 3 = Cooled-KLL compacted on a background thread." << std::endl;
         return 1;
     }
 
@@ -69,6 +70,7 @@ int main(int argc, char* argv[]){
     size_t n_buckets, buckets_capacity; 
     int compactor_size; 
     float compression_factor = 0.7;
+    int engine = 0;
 
     // Verificacion de pertinencia de los argumentos
     try{
@@ -78,6 +80,7 @@ int main(int argc, char* argv[]){
         n_buckets = std::stoll(argv[4]);
         buckets_capacity = std::stoll(argv[5]);
         compactor_size = std::stoll(argv[6]); 
+        if (argc == 8) engine = std::stoi(argv[7]);
 
         if (k_ <= 0 or k_ > 31){
             std::cerr << "<k-mer length> must be a number belonging to [1, 31]." << std::endl;
@@ -99,6 +102,10 @@ int main(int argc, char* argv[]){
             std::cerr << "<C_size> must be greater than 0." << std::endl;
             std::exit(EXIT_FAILURE);
         }
+        if (engine < 0 or engine > 3){
+            std::cerr << "[engine] must be a 0, 1, 2 or 3." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
     } catch (std::exception e){
         std::cerr << "Error: " << e.what() << std::endl;
         std::exit(1);
@@ -109,9 +116,9 @@ int main(int argc, char* argv[]){
     std::vector<std::pair<uint64_t, uint64_t>> kmers_dist = leerKmers(kmers_path);
 
     if (frequency_distribution){
-        frequencyExperiments(kmers_dist, k_, quantile_ratio, n_buckets, buckets_capacity, compactor_size, compression_factor);
+        frequencyExperiments(kmers_dist, k_, quantile_ratio, n_buckets, buckets_capacity, compactor_size, compression_factor, static_cast<Engine>(engine));
     } else {
-        kmersExperiments(kmers_dist, k_, quantile_ratio, n_buckets, buckets_capacity, compactor_size, compression_factor);
+        kmersExperiments(kmers_dist, k_, quantile_ratio, n_buckets, buckets_capacity, compactor_size, compression_factor, static_cast<Engine>(engine));
     }
     
 }
\ No newline at end of file
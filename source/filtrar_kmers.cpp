@@ -2,12 +2,15 @@
 #include <fstream>
 
 #include "../include/procesarKmers.hpp"
-#include "cooled-kll.cpp"
+#include "sharded-cooled-kll.cpp"
+#include "hybrid-sketch.cpp"
+#include "background-kll.cpp"
+#include "log-histogram.cpp"
 
 int main(int argc, char* argv[]){
     // Verificacion de correctitud en la ejecucion del programa
-    if (argc != 9){
-        std::cerr << "correct usage: ./exe <folder_file> <save_file> <k-mers_length> <N_buckets> <B_capacity> <C_size> <l_quantile> <u_quantile>" << std::endl;
+    if (argc < 9 or argc > 12){
+        std::cerr << "correct usage: ./exe <folder_file> <save_file> <k-mers_length> <N_buckets> <B_capacity> <C_size> <l_quantile> <u_quantile> [threads] [engine] [accuracy]" << std::endl;
         std::cerr << "<folder_file>: path to the folder with genomic lectures of FASTA type." << std::endl;
         std::cerr << "<save_file>: path to the file where statistics of filtering will be saved." << std::endl;
         std::cerr << "<k-mers_length>: length of kmers." << std::endl;
@@ -16,6 +19,9 @@ int main(int argc, char* argv[]){
         std::cerr << "<C_size>: number of elements of the largest compactor in the classic kll part." << std::endl;
         std::cerr << "<l_quantile>: lower quantile to filter data." << std::endl;
         std::cerr << "<u_quantile>: upper quantile to filter data." << std::endl;
+        std::cerr << "[threads]: threads used to build the sketch, 1 by default." << std::endl;
+        std::cerr << "[engine]: quantile engine: 0 = Cooled-KLL (default) | 1 = logarithmic histogram | 2 = exact histogram that switches to the Cooled-KLL | 3 = Cooled-KLL compacted on a background thread, only with one thread." << std::endl;
+        std::cerr << "[accuracy]: ranks answered with most accuracy by the KLL: 0 = uniform (default) | 1 = low tail | 2 = high tail | 3 = both tails." << std::endl;
         return 1;
     }
 
@@ -31,6 +37,9 @@ int main(int argc, char* argv[]){
     // Filter settings
     float lower_quantile;
     float upper_quantile;
+    size_t threads = 1;
+    int engine = 0;
+    int accuracy = 0;
 
 
     // Verificacion de pertinencia de los argumentos
@@ -43,6 +52,9 @@ int main(int argc, char* argv[]){
         compactor_size = std::stoll(argv[6]);
         lower_quantile = std::stof(argv[7]);
         upper_quantile = std::stof(argv[8]);
+        if (argc >= 10) threads = std::stoull(argv[9]);
+        if (argc >= 11) engine = std::stoi(argv[10]);
+        if (argc == 12) accuracy = std::stoi(argv[11]);
 
         if (k <= 0 or k > 31){
             std::cerr << "<k-mer length> must be a number belonging to [1, 31]." << std::endl;
@@ -60,6 +72,22 @@ int main(int argc, char* argv[]){
             std::cerr << "<C_size> must be greater than 0." << std::endl;
             std::exit(EXIT_FAILURE);
         }
+        if (threads == 0){
+            std::cerr << "[threads] must be greater than 0." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        if (engine < 0 or engine > 3){
+            std::cerr << "[engine] must be a 0, 1, 2 or 3." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        if (engine == 3 and threads > 1){
+            std::cerr << "[engine] 3 only works with one thread." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
+        if (accuracy < 0 or accuracy > 3){
+            std::cerr << "[accuracy] must be a 0, 1, 2 or 3." << std::endl;
+            std::exit(EXIT_FAILURE);
+        }
         if (lower_quantile <= 0 or lower_quantile >= 1 or upper_quantile <= 0 or upper_quantile >= 1){
             std::cerr << "<l_quantile> and <r_quantile> must belong to ]0,1[" << std::endl;
         }
@@ -74,16 +102,47 @@ int main(int argc, char* argv[]){
 
     std::cout << "!Creando el sketch!" << std::endl;
     size_t total_kmers = kmers.size();
-    CooledKLL sketch(n_buckets, buckets_capacity, eviction_threshold, compactor_size, compression_factor);
-    for (size_t i=0 ; i<total_kmers ; i++){
-        sketch.insert(kmers[i].second);
+    size_t lower_bound, upper_bound;
+    // El sketch se libera al terminar la funcion, antes de ordenar los k-mers
+    auto filtrar = [&](auto& sketch){
+        sketch.insert_batch(std::span(kmers), [](const std::pair<uint64_t, size_t>& kmer){
+            return kmer.second;
+        });
+
+        std::vector<double> deltas = {lower_quantile, upper_quantile};
+        std::vector<int_t> bounds = sketch.quantiles(deltas);
+        lower_bound = bounds[0];
+        upper_bound = bounds[1];
+    };
+    // Como solo se consultan cuantiles extremos, el KLL puede compactar protegiendo las colas
+    // de la distribucion. Con el motor hibrido las abundancias se cuentan de forma exacta y
+    // solo pasan al Cooled-KLL si superan el umbral de valores distintos, y con el motor en
+    // segundo plano las compactaciones corren en otro hilo mientras se insertan las abundancias
+    auto filtrarCooled = [&](auto& sketch){
+        sketch.setRankAccuracy(static_cast<RankAccuracy>(accuracy));
+        if (engine == 2){
+            HybridSketch hybrid(sketch);
+            filtrar(hybrid);
+        } else if (engine == 3){
+            BackgroundKLL background(sketch);
+            filtrar(background);
+        } else {
+            filtrar(sketch);
+        }
+    };
+    if (engine == 1){
+        // El histograma logaritmico se construye en un solo hilo
+        LogHistogram<> sketch;
+        filtrar(sketch);
+    } else if (threads > 1){
+        // Con varios hilos cada uno construye un fragmento del sketch
+        ShardedCooledKLL<> sketch(threads, n_buckets, buckets_capacity, eviction_threshold, compactor_size, compression_factor);
+        filtrarCooled(sketch);
+    } else {
+        withCooledKLL(n_buckets, buckets_capacity, eviction_threshold, compactor_size, compression_factor, filtrarCooled);
     }
-
-    size_t lower_bound = sketch.quantile(lower_quantile);
-    size_t upper_bound = sketch.quantile(upper_quantile);
     
     std::cout << "Se eliminaran los K-mers con abundancia menor a " << lower_bound << " y mayor a " << upper_bound << "." << std::endl;
-    sketch.~CooledKLL();
 
     std::sort(kmers.begin(), kmers.end(), [](const auto& a, const auto& b){
         return a.second < b.second;
@@ -0,0 +1,228 @@
+#ifndef HYBRID_SKETCH_CPP
+#define HYBRID_SKETCH_CPP
+
+#include "cooled-kll.cpp"
+
+
+/**
+ * Exact histogram in front of a sketch, for streams with few distinct values such as the
+ * abundances of the k-mers. While the stream has at most distinct_threshold different values
+ * they are counted exactly in a sorted array of (value, count), and the queries are exact.
+ * When one more value shows up the histogram is inserted into the sketch as weighted
+ * elements, the array is released and from then on everything goes to the sketch.
+ *
+ * By default the threshold is as many values as fit in the memory of the empty sketch, so
+ * the exact stage never takes more memory than the sketch it stands in for. The arrays grow
+ * with the distinct values seen, and memory() counts them on top of the empty sketch, so
+ * while exact it reports at most twice the memory of the sketch alone.
+ *
+ * The sketch is created by the caller, since every sketch has its own constructor, and must
+ * be empty and outlive this object.
+ */
+template <typename Sketch, typename T = int_t>
+class HybridSketch{
+private:
+    Sketch& sketch;
+    size_t distinct_threshold;
+    bool exact;
+    // Distinct values in ascending order, and the count of each one
+    std::vector<T> keys;
+    std::vector<size_t> counts;
+    // Sorted view used by the queries while exact, dropped on every insert.
+    Summary<T> summary;
+    bool summary_valid;
+public:
+    /**
+     * @brief Construct a new hybrid sketch.
+     *
+     * @param sketch Empty sketch that receives the data once the histogram is abandoned.
+     * @param distinct_threshold Maximum number of distinct values counted exactly, 0 for as
+     * many as fit in the memory of the sketch.
+     */
+    HybridSketch(Sketch& sketch, size_t distinct_threshold = 0) : sketch(sketch){
+        if (distinct_threshold == 0){
+            distinct_threshold = std::max<size_t>(sketch.memory() / (sizeof(T) + sizeof(size_t)), 1);
+        }
+        this->distinct_threshold = distinct_threshold;
+        this->exact = true;
+        this->summary_valid = false;
+    }
+
+    /**
+     * @brief Insert an element, or multiple times an element.
+     *
+     * @param element Element to insert.
+     * @param frequency Times the element must be inserted.
+     */
+    void insert(T element, size_t frequency = 1){
+        if (exact) count(element, frequency);
+        else sketch.insert(element, frequency);
+    }
+
+    /**
+     * @brief Inserts a batch of elements. The part of the batch after the switch to the sketch
+     * is handed to its own insert_batch.
+     *
+     * @param elements Elements to insert.
+     */
+    void insert_batch(std::span<const T> elements){
+        size_t counted = countWhileExact(elements.size(), [&](size_t i){ return elements[i]; }, [](size_t){ return size_t(1); });
+        if (counted < elements.size()) sketch.insert_batch(elements.subspan(counted));
+    }
+
+    /**
+     * @brief Inserts a batch of elements with their frequencys, as insert_batch.
+     *
+     * @param elements Pairs (element, frequency) to insert.
+     */
+    void insert_batch(std::span<const std::pair<T, size_t>> elements){
+        size_t counted = countWhileExact(elements.size(), [&](size_t i){ return elements[i].first; }, [&](size_t i){ return elements[i].second; });
+        if (counted < elements.size()) sketch.insert_batch(elements.subspan(counted));
+    }
+
+    /**
+     * @brief Inserts the element that element(item) gives for every item, as insert_batch.
+     *
+     * @param items Items to insert.
+     * @param element Callable returning the element to insert for an item.
+     */
+    template <typename Item, typename Element>
+    void insert_batch(std::span<Item> items, Element element){
+        size_t counted = countWhileExact(items.size(), [&](size_t i){ return static_cast<T>(element(items[i])); }, [](size_t){ return size_t(1); });
+        if (counted < items.size()) sketch.insert_batch(items.subspan(counted), element);
+    }
+
+    /**
+     * @brief Whether the data is still counted exactly.
+     */
+    bool isExact() const{
+        return exact;
+    }
+
+    size_t rank(T element){
+        if (not exact) return sketch.rank(element);
+        return getSummary().rank(element);
+    }
+
+    T quantile(float delta){
+        if (not exact) return sketch.quantile(delta);
+        if (delta < 0 or 1 < delta){
+            throw std::invalid_argument("delta must belong to [0, 1]");
+        }
+        const Summary<T>& elements = getSummary();
+        if (elements.items.empty()){
+            throw std::out_of_range("the sketch is empty");
+        }
+
+        size_t quantile_pos = static_cast<size_t>(std::round(delta * elements.total()));
+        return elements.items[elements.position(quantile_pos)];
+    }
+
+    std::vector<size_t> ranks(std::span<const T> elements){
+        if (not exact) return sketch.ranks(elements);
+        return getSummary().rank(elements);
+    }
+
+    std::vector<T> quantiles(std::span<const double> deltas){
+        if (not exact) return sketch.quantiles(deltas);
+        const Summary<T>& elements = getSummary();
+        if (elements.items.empty()){
+            throw std::out_of_range("the sketch is empty");
+        }
+
+        std::vector<size_t> indexes = elements.position(Summary<T>::positions(deltas, elements.total()));
+        std::vector<T> answer(deltas.size());
+        for (size_t q=0 ; q<deltas.size() ; q++){
+            answer[q] = elements.items[indexes[q]];
+        }
+        return answer;
+    }
+
+    /**
+     * @brief Gets the sorted histogram while the data is counted exactly, or the summary of
+     * the sketch after the switch.
+     *
+     * @return const Summary<T>& Items sorted with their accumulated weights.
+     */
+    const Summary<T>& getSummary(){
+        if (not exact) return sketch.getSummary();
+        if (summary_valid) return summary;
+
+        summary.build(histogram());
+        summary_valid = true;
+        return summary;
+    }
+
+    /**
+     * @brief Determines used memory of the object, counting the sketch. The summary is
+     * left out, as in the sketches.
+     *
+     * @return size_t: used memory in bytes.
+     */
+    size_t memory(){
+        return sizeof(*this) + sketch.memory()
+            + keys.capacity() * sizeof(T) + counts.capacity() * sizeof(size_t);
+    }
+
+private:
+    /**
+     * @brief Counts elements of a batch until the histogram is abandoned.
+     *
+     * @return size_t Index of the first element not counted, size if all of them were.
+     */
+    template <typename Element, typename Frequency>
+    size_t countWhileExact(size_t size, Element element, Frequency frequency){
+        size_t i = 0;
+        for ( ; i<size and exact ; i++) count(element(i), frequency(i));
+        // The element that caused the switch was already inserted into the sketch
+        return i;
+    }
+
+    void count(T element, size_t frequency){
+        if (frequency == 0) return;
+        summary_valid = false;
+
+        size_t idx = std::lower_bound(keys.begin(), keys.end(), element) - keys.begin();
+        if (idx < keys.size() and keys[idx] == element){
+            counts[idx] += frequency;
+            return;
+        }
+        if (keys.size() == distinct_threshold){
+            switchToSketch();
+            sketch.insert(element, frequency);
+            return;
+        }
+
+        // Keeping the arrays sorted shifts O(distinct values) entries per new value, so filling
+        // the stage costs O(distinct_threshold^2) moves in total. The abundances of the k-mers
+        // take few distinct values, and values already seen cost only the binary search
+        if (keys.size() == keys.capacity()){
+            // Grow by doubling but never past the threshold, so the stage stays within it
+            size_t capacity = std::min(std::max<size_t>(2 * keys.capacity(), 16), distinct_threshold);
+            keys.reserve(capacity);
+            counts.reserve(capacity);
+        }
+        keys.insert(keys.begin() + idx, element);
+        counts.insert(counts.begin() + idx, frequency);
+    }
+
+    std::vector<std::pair<T, size_t>> histogram() const{
+        std::vector<std::pair<T, size_t>> data(keys.size());
+        for (size_t i=0 ; i<keys.size() ; i++) data[i] = std::make_pair(keys[i], counts[i]);
+        return data;
+    }
+
+    /**
+     * @brief Moves the histogram into the sketch and releases the array and the summary.
+     */
+    void switchToSketch(){
+        std::vector<std::pair<T, size_t>> data = histogram();
+        sketch.insert_batch(std::span<const std::pair<T, size_t>>(data));
+        exact = false;
+        std::vector<T>().swap(keys);
+        std::vector<size_t>().swap(counts);
+        summary = Summary<T>();
+    }
+};
+
+#endif
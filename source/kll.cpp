@@ -1,34 +1,292 @@
+#ifndef KLL_CPP
+#define KLL_CPP
+
 #include <iostream>
 #include <vector>
 #include <algorithm>
 #include <random>
 #include <cmath>
-#include <ctime>
+#include <cstdint>
+#include <stdexcept>
 #include <set>
+#include <span>
+#include <array>
+#include <bit>
+#include <string>
+#include <type_traits>
+#include "snapshot.cpp"
 
 typedef uint64_t int_t;
-// 192 bits
+
+/**
+ * Query-ready view of a sketch: its items sorted in ascending order next to the
+ * accumulated weight up to (and including) each of them, so rank and quantile
+ * queries become binary searches.
+ */
+template <typename T = int_t>
+class Summary{
+public:
+    std::vector<T> items;
+    std::vector<size_t> ranks;
+
+    /**
+     * @brief Rebuilds the summary from weighted items.
+     * 
+     * @param data Pairs (item, weight), sorted by item.
+     */
+    void build(const std::vector<std::pair<T, size_t>>& data){
+        size_t size = data.size(), accumulated = 0;
+        items.resize(size);
+        ranks.resize(size);
+        for (size_t i=0 ; i<size ; i++){
+            accumulated += data[i].second;
+            items[i] = data[i].first;
+            ranks[i] = accumulated;
+        }
+    }
+
+    /**
+     * @brief Total weight of the summarized items.
+     */
+    size_t total() const{
+        return ranks.empty() ? 0 : ranks.back();
+    }
+
+    /**
+     * @brief Accumulated weight of the items less or equal to element.
+     * 
+     * @param element Element to calculate the rank.
+     * @return size_t Rank of the element.
+     */
+    size_t rank(T element) const{
+        size_t idx = std::upper_bound(items.begin(), items.end(), element) - items.begin();
+        return idx == 0 ? 0 : ranks[idx-1];
+    }
+
+    /**
+     * @brief Finds the first item whose accumulated weight exceeds pos.
+     * 
+     * @param pos Position in the weighted order of the items.
+     * @return size_t Index of the item, or of the last item if no one exceeds pos.
+     */
+    size_t position(size_t pos) const{
+        size_t idx = std::upper_bound(ranks.begin(), ranks.end(), pos) - ranks.begin();
+        return std::min(idx, items.size() - 1);
+    }
+
+    /**
+     * @brief Ranks of a batch of elements. Sorted batches are answered in a single
+     * merged pass over the items.
+     * 
+     * @param elements Elements to calculate the rank, preferably in ascending order.
+     * @return std::vector<size_t> Rank of each element, in the same order.
+     */
+    std::vector<size_t> rank(std::span<const T> elements) const{
+        size_t queries = elements.size(), size = items.size(), idx = 0;
+        std::vector<size_t> answer(queries);
+        for (size_t q=0 ; q<queries ; q++){
+            if (q != 0 and elements[q] < elements[q-1]){
+                idx = std::upper_bound(items.begin(), items.begin() + idx, elements[q]) - items.begin();
+            }
+            while (idx < size and items[idx] <= elements[q]) idx++;
+            answer[q] = idx == 0 ? 0 : ranks[idx-1];
+        }
+        return answer;
+    }
+
+    /**
+     * @brief Finds, for each position of a batch, the first item whose accumulated weight
+     * exceeds it. Sorted batches are answered in a single merged pass over the items.
+     * 
+     * @param positions Positions in the weighted order of the items, preferably in ascending order.
+     * @return std::vector<size_t> Index of the item for each position, in the same order.
+     */
+    std::vector<size_t> position(std::span<const size_t> positions) const{
+        size_t queries = positions.size(), size = items.size(), idx = 0;
+        std::vector<size_t> answer(queries);
+        for (size_t q=0 ; q<queries ; q++){
+            if (q != 0 and positions[q] < positions[q-1]){
+                idx = std::upper_bound(ranks.begin(), ranks.begin() + idx, positions[q]) - ranks.begin();
+            }
+            while (idx < size and ranks[idx] <= positions[q]) idx++;
+            answer[q] = std::min(idx, size - 1);
+        }
+        return answer;
+    }
+
+    /**
+     * @brief Converts a batch of quantiles into positions in the weighted order of the data.
+     * 
+     * @param deltas Quantiles to convert.
+     * @param total Total weight of the data.
+     * @return std::vector<size_t> Position of each quantile.
+     */
+    static std::vector<size_t> positions(std::span<const double> deltas, size_t total){
+        std::vector<size_t> positions(deltas.size());
+        for (size_t q=0 ; q<deltas.size() ; q++){
+            if (deltas[q] < 0 or 1 < deltas[q]){
+                throw std::invalid_argument("delta must belong to [0, 1]");
+            }
+            positions[q] = static_cast<size_t>(std::round(deltas[q] * total));
+        }
+        return positions;
+    }
+};
+
+/**
+ * Capacities of the compactors by their distance to the top one: round(k * c^d), and at
+ * least 2. Evaluated at compile time for the prebuilt configurations.
+ */
+constexpr std::array<size_t, 64> capacityTable(double k, double c){
+    std::array<size_t, 64> table{};
+    double factor = 1;
+    for (size_t d=0 ; d<table.size() ; d++){
+        table[d] = std::max(static_cast<size_t>(k * factor + 0.5), static_cast<size_t>(2));
+        factor *= c;
+    }
+    return table;
+}
+
+/**
+ * Capacities of the compactors for k and c given at runtime, as in capacityTable but without
+ * a fixed length: they go on until the first one that reaches the minimum of 2.
+ */
+inline std::vector<size_t> capacityVector(double k, double c){
+    std::vector<size_t> capacities;
+    double factor = 1;
+    do {
+        capacities.push_back(std::max(static_cast<size_t>(k * factor + 0.5), static_cast<size_t>(2)));
+        factor *= c;
+    } while (capacities.back() > 2);
+    return capacities;
+}
+
+/**
+ * Small splitmix64 generator that hands out fair coin flips one bit at a time from
+ * a cached 64-bit word.
+ */
+class CoinFlips{
+private:
+    uint64_t state, word;
+    int bits;
+public:
+    CoinFlips(uint64_t seed) : state(seed), word(0), bits(0){}
+
+    /**
+     * @brief Generates the next 64 random bits.
+     */
+    uint64_t next(){
+        uint64_t x = (state += UINT64_C(0x9e3779b97f4a7c15));
+        x = (x ^ (x >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+        x = (x ^ (x >> 27)) * UINT64_C(0x94d049bb133111eb);
+        return x ^ (x >> 31);
+    }
+
+    /**
+     * @brief Flips a fair coin.
+     */
+    bool flip(){
+        if (bits == 0){
+            word = next();
+            bits = 64;
+        }
+        bool heads = word & 1;
+        word >>= 1;
+        bits--;
+        return heads;
+    }
+
+    /**
+     * @brief Writes the state of the generator, so a loaded sketch flips the same coins.
+     */
+    void writeSnapshot(SnapshotWriter& writer) const{
+        writer.word(state);
+        writer.word(word);
+        writer.word(static_cast<uint64_t>(bits));
+    }
+
+    void readSnapshot(SnapshotReader& reader){
+        state = reader.word();
+        word = reader.word();
+        bits = static_cast<int>(reader.word() % 65);
+    }
+};
+
+/**
+ * Ranks a KLL answers with the most accuracy. UNIFORM is the classic KLL, whose error is a
+ * fraction of the total weight for every rank. The other ones compact as the REQ sketch does:
+ * every compactor keeps the half of its items nearest to the chosen tails and only compacts
+ * from the rest, so the error near a low tail is a fraction of the rank, and near a high tail
+ * a fraction of total - rank.
+ */
+enum class RankAccuracy{
+    UNIFORM = 0,
+    LOW_TAIL = 1,
+    HIGH_TAIL = 2,
+    BOTH_TAILS = 3
+};
+
+/**
+ * KLL sketch over items of type T. With K = 0 the capacity k and the factor c are given to
+ * the constructor; otherwise they are fixed at compile time to K and C.
+ */
+template <typename T = int_t, int K = 0, float C = 0.0f>
 class KLL{
 private:
-    std::vector<std::vector<int_t>> compactors;
+    static constexpr std::array<size_t, 64> CAPACITIES = capacityTable(K, C);
+
+    // All compactors live in one contiguous arena. Compactor i uses the slot
+    // [offsets[i], offsets[i+1]) and holds sizes[i] items. Compactor 0 is the
+    // highest (heaviest) level and compactor 'height' receives the new items.
+    // Every compactor but 'height' is kept sorted.
+    std::vector<T> arena;
+    std::vector<size_t> offsets, sizes;
+    // Items inserted with a frequency large enough to fill the top compactor on its own,
+    // kept as a single weighted entry each and sorted by item.
+    std::vector<std::pair<T, size_t>> heavy;
     size_t height, sketch_size;
     float k, c;
+    // Sorted view used by the queries, dropped on every insert.
+    Summary<T> summary;
+    bool summary_valid;
+    CoinFlips coins;
+    // Capacities by distance to the top compactor, used when k and c are given at runtime.
+    std::vector<size_t> capacities;
+    RankAccuracy accuracy;
+    // Compactions made by each compactor, which set how much of it the next one compacts
+    // when the accuracy is relative to a tail. Indexed as sizes.
+    std::vector<uint64_t> schedules;
+
+    // Sections in which the compactable half of a compactor is split for a tail accuracy
+    static constexpr size_t REQ_SECTIONS = 4;
 public:
     /**
      * @brief Construct a new KLL sketch and initialize de first compactor
      * 
      * @param k Capacity of the biggest compactor.
      * @param c Constant for reducing the next compactor size when creating a new one.
+     * @param seed Seed of the coin flips used by the compactions, fix it to replay a run.
      */
-    KLL(int k, float c) : k(k), c(c){
+    KLL(int k, float c, uint64_t seed = std::random_device{}()) requires (K == 0) : k(k), c(c), coins(seed){
         if (not (0.5 < c and c < 1)){
             throw std::invalid_argument("c must belong to (0.5, 1)");
         }
         if (k <= 0){
             throw std::invalid_argument("k must be greater than 0");
         }
-        height = 0;
-        compactors.emplace_back();
+        capacities = capacityVector(k, c);
+        initialize();
+    }
+
+    /**
+     * @brief Construct a new KLL sketch with k = K and c = C.
+     * 
+     * @param seed Seed of the coin flips used by the compactions, fix it to replay a run.
+     */
+    KLL(uint64_t seed = std::random_device{}()) requires (K != 0) : k(K), c(C), coins(seed){
+        static_assert(0.5 < C and C < 1, "C must belong to (0.5, 1)");
+        static_assert(K > 0, "K must be greater than 0");
+        initialize();
     }
 
     /**
@@ -36,55 +294,133 @@ public:
      * 
      * @param element Element to insert.
      */
-    void insert(int_t element){
-        compactors[height].push_back(element);
+    void insert(T element){
+        summary_valid = false;
+        reserve(height, 1);
+        arena[offsets[height] + sizes[height]++] = element;
         compaction();
     }
 
     /**
-     * @brief Insert multiple times an element into the sketch on an efficient way.
+     * @brief Insert multiple times an element into the sketch on an efficient way. The
+     * multiple of the top weight goes to a weighted entry, so the work and space are
+     * O(log frequency).
      * 
      * @param element Element to insert.
      * @param frequency Times the element must be inserted.
      */
-    void insert(int_t element, size_t frequency){
-        size_t rest = frequency, w;
+    void insert(T element, size_t frequency){
+        if (frequency == 0) return;
+        summary_valid = false;
+        size_t rest = frequency, w, copies, level;
         size_t exponent = static_cast<int>(log2(frequency));
         if (exponent > height) exponent = height;
+
+        // Copies that would overflow the top compactor on their own are kept as one weighted entry
+        if (exponent == height and (rest >> height) >= compactorCapacity(height)){
+            addHeavy(element, (rest >> height) << height);
+            rest &= weight(height) - 1;
+            if (rest == 0){
+                compaction();
+                return;
+            }
+            exponent = static_cast<int>(log2(rest));
+        }
         
         // Insert the element in the respective compactor following the binary representation of the number.
         while (rest > 0){
             w = weight(exponent);
-            while (rest >= w){
-                compactors[height - exponent].push_back(element);
-                rest -= w;
+            copies = rest / w;
+            level = height - exponent;
+            reserve(level, copies);
+            if (level == height){
+                std::fill_n(arena.begin() + offsets[level] + sizes[level], copies, element);
+            } else {
+                // keeps the compactor sorted opening a gap at the position of the element
+                T* compactor = arena.data() + offsets[level];
+                T* position = std::upper_bound(compactor, compactor + sizes[level], element);
+                std::copy_backward(position, compactor + sizes[level], compactor + sizes[level] + copies);
+                std::fill_n(position, copies, element);
             }
-            exponent = static_cast<int>(log2(rest));
+            sizes[level] += copies;
+            rest -= copies * w;
+            if (rest > 0) exponent = static_cast<int>(log2(rest));
         }
 
         compaction();
     }
 
     /**
-     * @brief Estimates the rank of the given element.
+     * @brief Merges another sketch built with the same parameters into this one, so this
+     * sketch summarizes the union of both streams. Compactors of equal weight are merged
+     * level by level and compacted afterwards.
      * 
-     * @param element Element to calculate the rank.
-     * @return int_t Rank of the element.
+     * @param other Sketch to merge. It is not modified.
      */
-    size_t rank(int_t element){
-        size_t rank = 0, compactor_rank = 0;
-        size_t compactor_size;
-        for (size_t i=0 ; i<=height ; i++){
-            compactor_size = compactors[i].size();
-            for (size_t j=0 ; j<compactor_size ; j++){
-                if (compactors[i][j] <= element){
-                    compactor_rank++;
-                }
+    void merge(const KLL& other){
+        if (&other == this){
+            // Merging reads the other sketch while this one grows, so merge a copy of itself
+            KLL copy(other);
+            merge(copy);
+            return;
+        }
+        if (k != other.k or c != other.c){
+            throw std::invalid_argument("only sketches with the same k and c can be merged");
+        }
+        if (accuracy != other.accuracy){
+            throw std::invalid_argument("only sketches with the same rank accuracy can be merged");
+        }
+        summary_valid = false;
+
+        // Adds empty top compactors until this sketch reaches the weights of the other one
+        while (height < other.height){
+            addTopLevel();
+        }
+
+        // Merges each compactor of the other sketch into the compactor of the same weight
+        size_t shift = height - other.height, level;
+        const T* run;
+        for (size_t i=0 ; i<=other.height ; i++){
+            level = i + shift;
+            run = other.arena.data() + other.offsets[i];
+            reserve(level, other.sizes[i]);
+            if (level == height){
+                std::copy_n(run, other.sizes[i], arena.begin() + offsets[level] + sizes[level]);
+                sizes[level] += other.sizes[i];
+            } else if (i == other.height){
+                // the lowest compactor of the other sketch is not sorted
+                std::vector<T> sorted(run, run + other.sizes[i]);
+                std::sort(sorted.begin(), sorted.end());
+                mergeRun(level, sorted.data(), sorted.size());
+            } else {
+                mergeRun(level, run, other.sizes[i]);
             }
-            rank += compactor_rank * weight(height-i);
-            compactor_rank = 0;
         }
-        return rank;
+
+        size_t heavy_size = other.heavy.size();
+        for (size_t i=0 ; i<heavy_size ; i++){
+            addHeavy(other.heavy[i].first, other.heavy[i].second);
+        }
+
+        // Compacts until every compactor is below its capacity
+        bool overflow = true;
+        while (overflow){
+            compaction();
+            overflow = false;
+            for (size_t i=0 ; i<=height ; i++){
+                if (sizes[height-i] >= compactorCapacity(i)) overflow = true;
+            }
+        }
+    }
+
+    /**
+     * @brief Estimates the rank of the given element.
+     * 
+     * @param element Element to calculate the rank.
+     * @return size_t Rank of the element.
+     */
+    size_t rank(T element){
+        return getSummary().rank(element);
     }
     
 
@@ -92,52 +428,115 @@ public:
      * @brief Estimates the delta-quantile of the data in the sketch.
      * 
      * @param delta Quantile to estimate.
-     * @return int_t Element that is the delta-quantile of the data.
+     * @return T Element that is the delta-quantile of the data.
      */
-    int_t quantile(float delta){
+    T quantile(float delta){
         if (delta < 0 or 1 < delta){
             throw std::invalid_argument("delta must belong to [0, 1]");
         }
-        size_t data_size, counter = 0, quantile_pos;
-        std::vector<std::pair<int_t, size_t>> elements;
-        elements = data();
-
-        quantile_pos = static_cast<size_t>(std::round(delta * sketch_size));
-        data_size = elements.size();
-        for (size_t i=0 ; i<data_size ; i++){
-            counter+=elements[i].second;
-            if (counter > quantile_pos){
-                if (i != 0) return elements[i-1].first;
-                else return elements[i].first;
-            }
+        const Summary<T>& elements = getSummary();
+        if (elements.items.empty()){
+            throw std::out_of_range("the sketch is empty");
+        }
+
+        size_t quantile_pos = static_cast<size_t>(std::round(delta * sketch_size));
+        size_t i = elements.position(quantile_pos);
+        if (elements.ranks[i] > quantile_pos and i != 0) return elements.items[i-1];
+        return elements.items[i];
+    }
+
+    /**
+     * @brief Estimates the rank of a batch of elements building the summary only once.
+     * 
+     * @param elements Elements to calculate the rank, preferably in ascending order.
+     * @return std::vector<size_t> Rank of each element, in the same order.
+     */
+    std::vector<size_t> ranks(std::span<const T> elements){
+        return getSummary().rank(elements);
+    }
+
+    /**
+     * @brief Estimates a batch of quantiles building the summary only once.
+     * 
+     * @param deltas Quantiles to estimate, preferably in ascending order.
+     * @return std::vector<T> Element that is each of the quantiles, in the same order.
+     */
+    std::vector<T> quantiles(std::span<const double> deltas){
+        const Summary<T>& elements = getSummary();
+        if (elements.items.empty()){
+            throw std::out_of_range("the sketch is empty");
+        }
+
+        std::vector<size_t> positions = Summary<T>::positions(deltas, sketch_size);
+        std::vector<size_t> indexes = elements.position(positions);
+        std::vector<T> answer(deltas.size());
+        for (size_t q=0 ; q<deltas.size() ; q++){
+            size_t i = indexes[q];
+            if (elements.ranks[i] > positions[q] and i != 0) answer[q] = elements.items[i-1];
+            else answer[q] = elements.items[i];
         }
-        return elements[data_size-1].first;
+        return answer;
     }
 
     /**
      * @brief Creates a sorted vector with the elements in the sketch.
      * 
-     * @return std::vector<std::pair<int_t, size_t>> Ordered vector with all the elements in the sketch.
+     * @return std::vector<std::pair<T, size_t>> Ordered vector with all the elements in the sketch.
      */
-    std::vector<std::pair<int_t, size_t>> data(){
-        size_t compactor_size, w;
+    std::vector<std::pair<T, size_t>> data(){
+        const Summary<T>& elements = getSummary();
+        size_t size = elements.items.size();
+
+        std::vector<std::pair<T, size_t>> data(size);
+        for (size_t i=0 ; i<size ; i++){
+            data[i].first = elements.items[i];
+            data[i].second = elements.ranks[i] - (i == 0 ? 0 : elements.ranks[i-1]);
+        }
+        return data;
+    }
+
+    /**
+     * @brief Gets the sorted summary of the sketch, rebuilding it only if an insertion
+     * happened since the last query.
+     * 
+     * @return const Summary<T>& Items of the sketch sorted with their accumulated weights.
+     */
+    const Summary<T>& getSummary(){
+        if (summary_valid) return summary;
+
+        size_t w;
         sketch_size = 0;
 
-        std::vector<std::pair<int_t, size_t>> data;
+        auto by_item = [](const std::pair<T, size_t>& a, const std::pair<T, size_t>& b){
+            return a.first < b.first;
+        };
+
+        // Merges the already sorted compactors one after another
+        std::vector<std::pair<T, size_t>> data;
+        size_t merged;
         for (size_t i=0; i<=height ; i++){
-            compactor_size = compactors[i].size();
-            for (size_t j=0 ; j<compactor_size ; j++){
-                w = weight(height-i);
+            w = weight(height-i);
+            merged = data.size();
+            for (size_t j=0 ; j<sizes[i] ; j++){
                 sketch_size += w;
-                data.push_back(std::make_pair(compactors[i][j], w));
+                data.push_back(std::make_pair(arena[offsets[i] + j], w));
             }
+            if (i == height) std::sort(data.begin() + merged, data.end(), by_item);
+            std::inplace_merge(data.begin(), data.begin() + merged, data.end(), by_item);
         }
 
-        std::sort(data.begin(), data.end(), [](const std::pair<int_t, size_t>& a, const std::pair<int_t, size_t>& b){
-            return a.first < b.first;
-        });
+        // Merges the weighted entries
+        merged = data.size();
+        size_t heavy_size = heavy.size();
+        for (size_t i=0 ; i<heavy_size ; i++){
+            sketch_size += heavy[i].second;
+            data.push_back(heavy[i]);
+        }
+        std::inplace_merge(data.begin(), data.begin() + merged, data.end(), by_item);
 
-        return data;
+        summary.build(data);
+        summary_valid = true;
+        return summary;
     }
 
     /**
@@ -148,14 +547,15 @@ public:
     size_t memory(){
         size_t memory_used = 0;
 
-        // Calculates used memory by the elements themselves.
-        uint32_t size = compactors.size();
-        for (uint32_t i=0 ; i<size ; i++){
-            memory_used += compactors[i].size() * sizeof(size_t);
-        }
+        // Calculates used memory by the arena, including its free slots.
+        memory_used += arena.size() * sizeof(T);
 
-        // Calculates used memory by the internal elements of 'compactors' vector.
-        memory_used += compactors.size() * sizeof(std::vector<size_t>);
+        // Calculates used memory by the level offsets, sizes and schedules.
+        memory_used += (offsets.size() + sizes.size() + capacities.size()) * sizeof(size_t);
+        memory_used += schedules.size() * sizeof(uint64_t);
+
+        // Calculates used memory by the weighted entries.
+        memory_used += heavy.size() * sizeof(std::pair<T, size_t>);
         
         // static used memory
         memory_used += sizeof(*this);
@@ -164,46 +564,276 @@ public:
     }
 
     size_t getSketch_size(){
+        getSummary();
         return sketch_size;
     }
 
+    /**
+     * @brief Chooses the ranks answered with the most accuracy. Only while the sketch is empty,
+     * since it changes how the compactors already filled were compacted.
+     * 
+     * @param accuracy UNIFORM for the classic KLL, or the tails whose error is relative.
+     */
+    void setRankAccuracy(RankAccuracy accuracy){
+        bool empty = heavy.empty();
+        for (size_t i=0 ; i<=height ; i++){
+            if (sizes[i] != 0) empty = false;
+        }
+        if (not empty){
+            throw std::logic_error("the rank accuracy can only change while the sketch is empty");
+        }
+        this->accuracy = accuracy;
+    }
+
+    RankAccuracy getRankAccuracy() const{
+        return accuracy;
+    }
+
+    /**
+     * @brief Saves the sketch into a binary snapshot (see snapshot.cpp).
+     * 
+     * @param path Path to the snapshot, overwritten if it exists.
+     */
+    void save(const std::string& path){
+        SnapshotWriter writer(path);
+        writer.header(SNAPSHOT_KLL);
+        writer.summary(getSummary());
+        writer.headerField(3, writer.position());
+        writeSnapshot(writer);
+        writer.close();
+    }
+
+    /**
+     * @brief Replaces the content of the sketch with a snapshot saved by KLL::save.
+     * 
+     * @param path Path to the snapshot.
+     */
+    void load(const std::string& path){
+        MappedFile file(path);
+        SnapshotReader reader(file);
+        if (reader.header() != SNAPSHOT_KLL){
+            throw std::runtime_error("the snapshot does not hold a KLL: " + path);
+        }
+        reader.seek(reader.headerField(3));
+        readSnapshot(reader);
+    }
+
+    /**
+     * @brief Writes the KLL section of a snapshot.
+     */
+    void writeSnapshot(SnapshotWriter& writer){
+        static_assert(std::is_integral_v<T> and sizeof(T) <= sizeof(uint64_t), "only integer items up to 64 bits can be saved");
+        writer.word(static_cast<uint64_t>(k));
+        writer.word(std::bit_cast<uint32_t>(c));
+        writer.word(height);
+        writer.word(heavy.size());
+        coins.writeSnapshot(writer);
+        writer.word(static_cast<uint64_t>(accuracy));
+        writer.words(sizes.data(), height + 1);
+        writer.words(schedules.data(), height + 1);
+        for (size_t i=0 ; i<=height ; i++){
+            writer.words(arena.data() + offsets[i], sizes[i]);
+        }
+        for (size_t i=0 ; i<heavy.size() ; i++){
+            writer.word(static_cast<uint64_t>(heavy[i].first));
+            writer.word(heavy[i].second);
+        }
+    }
+
+    /**
+     * @brief Reads the KLL section of a snapshot.
+     */
+    void readSnapshot(SnapshotReader& reader){
+        int saved_k = static_cast<int>(reader.word());
+        float saved_c = std::bit_cast<float>(static_cast<uint32_t>(reader.word()));
+        if constexpr (K != 0){
+            if (saved_k != K or saved_c != C){
+                throw std::runtime_error("the snapshot was saved with other k and c");
+            }
+        } else {
+            if (not (0.5 < saved_c and saved_c < 1) or saved_k <= 0){
+                throw std::runtime_error("the snapshot has invalid k and c");
+            }
+            k = saved_k;
+            c = saved_c;
+            capacities = capacityVector(k, c);
+        }
+
+        height = reader.word();
+        size_t heavy_size = reader.word();
+        if (height >= 64) throw std::runtime_error("the snapshot has an invalid height");
+        coins.readSnapshot(reader);
+        // Version 1 snapshots only hold uniform sketches
+        accuracy = RankAccuracy::UNIFORM;
+        if (reader.getVersion() >= 2){
+            uint64_t saved_accuracy = reader.word();
+            if (saved_accuracy > static_cast<uint64_t>(RankAccuracy::BOTH_TAILS)){
+                throw std::runtime_error("the snapshot has an invalid rank accuracy");
+            }
+            accuracy = static_cast<RankAccuracy>(saved_accuracy);
+        }
+        sizes.assign(height + 1, 0);
+        reader.words(sizes.data(), height + 1);
+        schedules.assign(height + 1, 0);
+        if (reader.getVersion() >= 2) reader.words(schedules.data(), height + 1);
+
+        // The items and the heavy entries must fit in what is left of the file before
+        // allocating room for them
+        size_t remaining = reader.remainingWords();
+        for (size_t i=0 ; i<=height ; i++){
+            if (sizes[i] > remaining) throw std::runtime_error("truncated snapshot");
+            remaining -= sizes[i];
+        }
+        if (heavy_size > remaining / 2) throw std::runtime_error("truncated snapshot");
+
+        offsets.clear();
+        layout();
+        for (size_t i=0 ; i<=height ; i++){
+            reader.words(arena.data() + offsets[i], sizes[i]);
+        }
+        heavy.resize(heavy_size);
+        for (size_t i=0 ; i<heavy_size ; i++){
+            heavy[i].first = static_cast<T>(reader.word());
+            heavy[i].second = reader.word();
+        }
+
+        sketch_size = 0;
+        summary_valid = false;
+    }
+
 private:
+    /**
+     * @brief Initialize de first compactor.
+     * 
+     */
+    void initialize(){
+        height = 0;
+        sketch_size = 0;
+        summary_valid = false;
+        accuracy = RankAccuracy::UNIFORM;
+        sizes.push_back(0);
+        schedules.push_back(0);
+        layout();
+    }
+
     /**
      * @brief compacts each compactor from bottom to up if it has reached its maximum capacity.
      * 
      */
     void compaction(){
         for (size_t i=0 ; i<=height ; i++){
-            if (compactors[height-i].size() >= compactorCapacity(i)){
-                sortCompactor(compactors[height-i]);
+            if (sizes[height-i] >= compactorCapacity(i)){
+                // only the lowest compactor receives unsorted items
+                if (i == 0) sortCompactor(height);
                 if (i == height){
-                    height++;
-                    compactors.emplace_back();
-                    compactLastLevel();
+                    // the top compactor promotes into a new, heavier top compactor
+                    addTopLevel();
+                    compactLevel(1);
                 } else{
-                    compactLevel(compactors[height-i], height-i);
+                    compactLevel(height-i);
                 }
             }
         }
     }
 
+    /**
+     * @brief Rebuilds the arena giving each compactor a slot derived from its capacity.
+     * Only called when the sketch grows a level or a slot overflows, so insertions and
+     * compactions never allocate.
+     * 
+     * @param level Compactor that needs more room, if any.
+     * @param extra Items that must fit in that compactor besides the current ones.
+     */
+    void layout(size_t level = SIZE_MAX, size_t extra = 0){
+        std::vector<size_t> new_offsets(height + 2, 0);
+        size_t slot;
+        for (size_t i=0 ; i<=height ; i++){
+            // A compactor below its capacity can receive at most half of the one beneath it.
+            slot = compactorCapacity(height-i) + compactorCapacity(height-i) / 2 + 1;
+            if (i == level) slot = std::max(slot, 2 * (sizes[i] + extra));
+            slot = std::max(slot, sizes[i]);
+            new_offsets[i+1] = new_offsets[i] + slot;
+        }
+
+        std::vector<T> new_arena(new_offsets[height+1]);
+        for (size_t i=0 ; i<=height and i+1<offsets.size() ; i++){
+            std::copy_n(arena.begin() + offsets[i], sizes[i], new_arena.begin() + new_offsets[i]);
+        }
+        arena.swap(new_arena);
+        offsets.swap(new_offsets);
+    }
+
+    /**
+     * @brief Adds weight to the weighted entry of an element, creating it if needed.
+     * 
+     * @param element Element of the entry.
+     * @param w Weight to add.
+     */
+    void addHeavy(T element, size_t w){
+        auto position = std::lower_bound(heavy.begin(), heavy.end(), element, [](const std::pair<T, size_t>& a, T b){
+            return a.first < b;
+        });
+        if (position != heavy.end() and position->first == element) position->second += w;
+        else heavy.insert(position, std::make_pair(element, w));
+    }
+
+    /**
+     * @brief Merges a sorted run of items into a sorted compactor. It is merged from the
+     * back, so no buffer is needed; the room must be reserved beforehand.
+     * 
+     * @param level Index of the compactor.
+     * @param run First item of the run.
+     * @param count Number of items in the run.
+     * @param stride Distance between two consecutive items of the run.
+     */
+    void mergeRun(size_t level, const T* run, size_t count, size_t stride = 1){
+        T* compactor = arena.data() + offsets[level];
+        size_t a = sizes[level], b = count, out = a + count;
+        while (b > 0){
+            if (a > 0 and compactor[a-1] > run[(b-1) * stride]){
+                compactor[--out] = compactor[--a];
+            } else {
+                compactor[--out] = run[(--b) * stride];
+            }
+        }
+        sizes[level] += count;
+    }
+
+    /**
+     * @brief Makes sure the given compactor can receive 'extra' more items.
+     * 
+     * @param level Index of the compactor.
+     * @param extra Number of items to append.
+     */
+    void reserve(size_t level, size_t extra){
+        if (sizes[level] + extra > offsets[level+1] - offsets[level]){
+            layout(level, extra);
+        }
+    }
+
     /**
      * @brief Calculates compactor's capacity of the given level.
      * 
      * @param level Level of the compactor.
-     * @return uint64_t Capacity of the compactor.
+     * @return size_t Capacity of the compactor.
      */
-    int_t compactorCapacity(size_t level){
-        return std::max(static_cast<int>(std::round(k * std::pow(c, height - level))), 2);
+    size_t compactorCapacity(size_t level){
+        size_t depth = height - level;
+        if constexpr (K != 0){
+            return CAPACITIES[std::min(depth, CAPACITIES.size() - 1)];
+        } else {
+            return capacities[std::min(depth, capacities.size() - 1)];
+        }
     }
 
     /**
      * @brief Sort the given compactor.
      * 
-     * @param compactor Compactor to sort.
+     * @param idx Index of the compactor to sort.
      */
-    void sortCompactor(std::vector<int_t>& compactor){
-        std::sort(compactor.begin(), compactor.end());
+    void sortCompactor(size_t idx){
+        T* compactor = arena.data() + offsets[idx];
+        std::sort(compactor, compactor + sizes[idx]);
     }
 
     /**
@@ -213,56 +843,82 @@ private:
      * @return false If odd.
      */
     bool even(){
-        std::mt19937 gen(static_cast<unsigned int>(std::time(0)));
-        std::uniform_int_distribution<int> dist(1, 2);
-        int random_number = dist(gen);
-        return random_number == 2;
+        return coins.flip();
+    }
+
+    /**
+     * @brief Adds an empty compactor above the top one. The weights of the existing
+     * compactors do not change, but their capacities shrink by the factor c.
+     * 
+     */
+    void addTopLevel(){
+        sizes.insert(sizes.begin(), 0);
+        offsets.insert(offsets.begin(), 0);
+        schedules.insert(schedules.begin(), 0);
+        height++;
+        layout();
     }
 
     /**
-     * @brief Compacts the highest compactor maintaining half of the elements and deleting the other half.
+     * @brief Compacts the given compactor transferring half of the elements to the next level and deleting the other half.
      * 
+     * @param idx Index of the compactor in the arena.
      */
-    void compactLastLevel(){
-        size_t size = compactors[0].size(), i, idx = 0;
+    void compactLevel(size_t idx){
+        if (accuracy != RankAccuracy::UNIFORM){
+            compactSections(idx);
+            return;
+        }
+        size_t size = sizes[idx], i;
 
         // selects which elements will remain
         if (even()) i=0; else i=1;
-        
-        // moves selected elements to arrays begin
-        for (; i<size ; i+=2){
-            compactors[0][idx] = compactors[0][i];
-            idx++;
-        }
 
-        // Delete unselected elements
-        compactors[0].resize(idx);
+        // merges the selected elements, already sorted, into the next level
+        reserve(idx-1, (size - i + 1) / 2);
+        mergeRun(idx-1, arena.data() + offsets[idx] + i, (size - i + 1) / 2, 2);
+
+        // clears the compactor
+        sizes[idx] = 0;
     }
 
     /**
-     * @brief Compacts the given compactor transferring half of the elements to the next level and deleting the other half.
+     * @brief Compacts part of the given compactor as REQ does. Half of its capacity, the items
+     * nearest to the accurate tails, is never compacted. The other half is split into
+     * REQ_SECTIONS sections and the compaction takes as many of them as the trailing ones of
+     * the compactor's schedule plus one, the sections farthest from the tails first, so the
+     * items near the tails are compacted exponentially less often. At least enough items to
+     * leave the compactor below its capacity are compacted, always an even number so no
+     * weight is lost.
      * 
-     * @param compactor Compactor to compact.
-     * @param idx Index of the compactor in the vector of compactors.
+     * @param idx Index of the compactor in the arena.
      */
-    void compactLevel(std::vector<int_t>& compactor, size_t idx){
-        size_t size = compactor.size(), i;
-        std::vector<int_t> buffer;
+    void compactSections(size_t idx){
+        size_t size = sizes[idx], capacity = compactorCapacity(height - idx);
+        size_t section = std::max<size_t>(capacity / (2 * REQ_SECTIONS), 1);
+        size_t sections = std::min<size_t>(std::countr_one(schedules[idx]) + 1, REQ_SECTIONS);
+        schedules[idx]++;
 
-        // selects which elements will remain
-        if (even()) i=0; else i=1;
-        
-        // temporarily stores selected elements in the buffer
-        for (; i<size ; i+=2){
-            buffer.push_back(compactor[i]);
-        }
+        size_t count = std::min(sections * section, size - std::min(size, capacity / 2));
+        if (size >= capacity) count = std::max(count, size - capacity + 1);
+        if (count % 2 == 1) count = count + 1 <= size ? count + 1 : count - 1;
+        if (count == 0) return;
 
-        // clears the compactor and transfers selected elements to the next level
-        compactor.clear();
-        size = buffer.size();
-        for(size_t i=0 ; i<size ; i++){
-            compactors[idx-1].push_back(buffer[i]);
-        }
+        // the compacted items are the ones farthest from the accurate tails
+        size_t start;
+        if (accuracy == RankAccuracy::LOW_TAIL) start = size - count;
+        else if (accuracy == RankAccuracy::HIGH_TAIL) start = 0;
+        else start = (size - count) / 2;
+
+        // merges one of every two compacted items, already sorted, into the next level
+        size_t i = even() ? 0 : 1;
+        reserve(idx-1, count / 2);
+        mergeRun(idx-1, arena.data() + offsets[idx] + start + i, count / 2, 2);
+
+        // closes the gap left by the compacted items
+        T* compactor = arena.data() + offsets[idx];
+        std::copy(compactor + start + count, compactor + size, compactor + start);
+        sizes[idx] -= count;
     }
 
     /**
@@ -272,7 +928,7 @@ private:
      * @return size_t Weight of the level.
      */
     size_t weight(size_t level){
-        return std::pow(2, level);
+        return static_cast<size_t>(1) << level;
     }
 };
 
@@ -284,4 +940,6 @@ private:
 //     }
 
 //     std::cout << "Rank de " << num << ": "<< sketch.rank(10) << std::endl;
-// }
\ No newline at end of file
+// }
+
+#endif
\ No newline at end of file
@@ -0,0 +1,213 @@
+#ifndef LOG_HISTOGRAM_CPP
+#define LOG_HISTOGRAM_CPP
+
+#include <limits>
+
+#include "kll.cpp"
+
+
+/**
+ * Histogram of non-negative integers with logarithmically spaced buckets, in the style of
+ * DDSketch and HdrHistogram. Every bucket spans values whose ratio is at most
+ * gamma = (1 + alpha) / (1 - alpha), so answering with a value of the bucket is off by at
+ * most a fraction alpha of the true one. The values under 1 / (gamma - 1), where a bucket
+ * would be narrower than one integer, get a bucket each and are exact.
+ *
+ * An insert is a logarithm and an increment, there are no compactions, and the number of
+ * buckets only depends on the largest value inserted: about log(max) / log(gamma).
+ */
+template <typename T = int_t>
+class LogHistogram{
+    static_assert(std::is_integral_v<T> and std::is_unsigned_v<T>, "LogHistogram only holds unsigned integers");
+private:
+    double relative_accuracy, gamma, inverse_log_gamma;
+    // Values under linear_limit have their own bucket, the others go to the logarithmic ones
+    T linear_limit;
+    int64_t log_offset;
+    std::vector<size_t> counts;
+    Summary<T> summary;
+    bool summary_valid;
+public:
+    static constexpr double DEFAULT_ACCURACY = 0.01;
+
+    /**
+     * @brief Construct a new logarithmic histogram.
+     *
+     * @param relative_accuracy Maximum relative error of the returned quantiles, in ]0, 1[.
+     */
+    LogHistogram(double relative_accuracy = DEFAULT_ACCURACY){
+        if (not (0 < relative_accuracy and relative_accuracy < 1)){
+            throw std::invalid_argument("relative_accuracy must belong to ]0, 1[");
+        }
+        this->relative_accuracy = relative_accuracy;
+        this->gamma = (1 + relative_accuracy) / (1 - relative_accuracy);
+        this->inverse_log_gamma = 1 / std::log(gamma);
+        this->linear_limit = static_cast<T>(std::min<double>(std::ceil(1 / (gamma - 1)), std::numeric_limits<T>::max()));
+        this->linear_limit = std::max<T>(linear_limit, 1);
+        this->log_offset = static_cast<int64_t>(linear_limit) - logIndex(linear_limit);
+        this->summary_valid = false;
+    }
+
+    /**
+     * @brief Insert an element, or multiple times an element, into the histogram.
+     *
+     * @param element Element to insert.
+     * @param frequency Times the element must be inserted.
+     */
+    void insert(T element, size_t frequency = 1){
+        summary_valid = false;
+        size_t idx = index(element);
+        if (idx >= counts.size()) counts.resize(idx + 1, 0);
+        counts[idx] += frequency;
+    }
+
+    /**
+     * @brief Inserts a batch of elements.
+     *
+     * @param elements Elements to insert.
+     */
+    void insert_batch(std::span<const T> elements){
+        for (size_t i=0 ; i<elements.size() ; i++) insert(elements[i]);
+    }
+
+    /**
+     * @brief Inserts a batch of elements with their frequencys.
+     *
+     * @param elements Pairs (element, frequency) to insert.
+     */
+    void insert_batch(std::span<const std::pair<T, size_t>> elements){
+        for (size_t i=0 ; i<elements.size() ; i++) insert(elements[i].first, elements[i].second);
+    }
+
+    /**
+     * @brief Inserts the element that element(item) gives for every item.
+     *
+     * @param items Items to insert.
+     * @param element Callable returning the element to insert for an item.
+     */
+    template <typename Item, typename Element>
+    void insert_batch(std::span<Item> items, Element element){
+        for (size_t i=0 ; i<items.size() ; i++) insert(static_cast<T>(element(items[i])));
+    }
+
+    /**
+     * @brief Estimates the rank of the given element.
+     *
+     * @param element Element to estimate the rank.
+     * @return size_t Amount of elements that are less or equal to element.
+     */
+    size_t rank(T element){
+        return getSummary().rank(element);
+    }
+
+    /**
+     * @brief Estimates the delta-quantile of the data in the histogram.
+     *
+     * @param delta Quantile to estimate.
+     * @return T Element within the relative accuracy of the delta-quantile of the data.
+     */
+    T quantile(float delta){
+        if (delta < 0 or 1 < delta){
+            throw std::invalid_argument("delta must belong to [0, 1]");
+        }
+        const Summary<T>& elements = getSummary();
+        if (elements.items.empty()){
+            throw std::out_of_range("the sketch is empty");
+        }
+
+        size_t quantile_pos = static_cast<size_t>(std::round(delta * elements.total()));
+        return elements.items[elements.position(quantile_pos)];
+    }
+
+    /**
+     * @brief Estimates the rank of a batch of elements building the summary only once.
+     *
+     * @param elements Elements to estimate the rank, preferably in ascending order.
+     * @return std::vector<size_t> Amount of elements that are less or equal to each element.
+     */
+    std::vector<size_t> ranks(std::span<const T> elements){
+        return getSummary().rank(elements);
+    }
+
+    /**
+     * @brief Estimates a batch of quantiles building the summary only once.
+     *
+     * @param deltas Quantiles to estimate, preferably in ascending order.
+     * @return std::vector<T> Element that is each of the quantiles, in the same order.
+     */
+    std::vector<T> quantiles(std::span<const double> deltas){
+        const Summary<T>& elements = getSummary();
+        if (elements.items.empty()){
+            throw std::out_of_range("the sketch is empty");
+        }
+
+        std::vector<size_t> indexes = elements.position(Summary<T>::positions(deltas, elements.total()));
+        std::vector<T> answer(deltas.size());
+        for (size_t q=0 ; q<deltas.size() ; q++){
+            answer[q] = elements.items[indexes[q]];
+        }
+        return answer;
+    }
+
+    /**
+     * @brief Gets the non-empty buckets, each one as its representative value, rebuilding
+     * them only if an insertion happened since the last query.
+     *
+     * @return const Summary<T>& Representatives sorted with their accumulated counts.
+     */
+    const Summary<T>& getSummary(){
+        if (summary_valid) return summary;
+
+        std::vector<std::pair<T, size_t>> data;
+        for (size_t i=0 ; i<counts.size() ; i++){
+            if (counts[i] != 0) data.push_back(std::make_pair(representative(i), counts[i]));
+        }
+        summary.build(data);
+        summary_valid = true;
+        return summary;
+    }
+
+    double getRelative_accuracy() const{
+        return relative_accuracy;
+    }
+
+    /**
+     * @brief Determines used memory of the object. The summary is left out, as in the sketches.
+     *
+     * @return size_t: used memory in bytes.
+     */
+    size_t memory(){
+        return sizeof(*this) + counts.capacity() * sizeof(size_t);
+    }
+
+private:
+    /**
+     * @brief Index of the logarithmic bucket of value: the smallest i with value <= gamma^i.
+     */
+    int64_t logIndex(T value) const{
+        return static_cast<int64_t>(std::ceil(std::log(static_cast<double>(value)) * inverse_log_gamma));
+    }
+
+    size_t index(T value) const{
+        if (value < linear_limit) return static_cast<size_t>(value);
+        return static_cast<size_t>(log_offset + logIndex(value));
+    }
+
+    /**
+     * @brief Value answered for the bucket idx. For a logarithmic bucket, which holds the
+     * values in ]gamma^(i-1), gamma^i], it is the one with the same relative error to both
+     * ends, moved inside the integers of the bucket.
+     */
+    T representative(size_t idx) const{
+        if (idx < linear_limit) return static_cast<T>(idx);
+        double i = static_cast<double>(static_cast<int64_t>(idx) - log_offset);
+        double upper = std::floor(std::pow(gamma, i)), lower = std::floor(std::pow(gamma, i - 1)) + 1;
+        lower = std::max(lower, static_cast<double>(linear_limit));
+        upper = std::max(upper, lower);
+        double value = std::clamp(std::round(2 * std::pow(gamma, i) / (gamma + 1)), lower, upper);
+        if (value >= static_cast<double>(std::numeric_limits<T>::max())) return std::numeric_limits<T>::max();
+        return static_cast<T>(value);
+    }
+};
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef MAPPED_FILE_CPP
+#define MAPPED_FILE_CPP
+
+#include <cstddef>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * Read-only view of a whole file: memory-mapped where mmap is available, read into memory
+ * otherwise.
+ */
+class MappedFile{
+private:
+    const unsigned char* bytes;
+    size_t length;
+    std::vector<unsigned char> buffer;
+public:
+    MappedFile(const std::string& path) : bytes(nullptr), length(0){
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("could not open " + path);
+        struct stat info;
+        if (::fstat(fd, &info) != 0){
+            ::close(fd);
+            throw std::runtime_error("could not stat " + path);
+        }
+        length = static_cast<size_t>(info.st_size);
+        if (length > 0){
+            void* mapping = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED){
+                ::close(fd);
+                throw std::runtime_error("could not map " + path);
+            }
+            bytes = static_cast<const unsigned char*>(mapping);
+        }
+        ::close(fd);
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (not file.is_open()) throw std::runtime_error("could not open " + path);
+        length = static_cast<size_t>(file.tellg());
+        buffer.resize(length);
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(buffer.data()), length);
+        bytes = buffer.data();
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile(){
+#ifndef _WIN32
+        if (bytes != nullptr) ::munmap(const_cast<unsigned char*>(bytes), length);
+#endif
+    }
+
+    /**
+     * @brief Tells the kernel the file will be read once from start to end, so it reads
+     * ahead aggressively and drops the pages already read.
+     */
+    void adviseSequential() const{
+#ifndef _WIN32
+        if (bytes != nullptr) ::madvise(const_cast<unsigned char*>(bytes), length, MADV_SEQUENTIAL);
+#endif
+    }
+
+    /**
+     * @brief Asks the kernel to start reading the whole file in the background.
+     */
+    void adviseWillNeed() const{
+#ifndef _WIN32
+        if (bytes != nullptr) ::madvise(const_cast<unsigned char*>(bytes), length, MADV_WILLNEED);
+#endif
+    }
+
+    const unsigned char* data() const{
+        return bytes;
+    }
+
+    size_t size() const{
+        return length;
+    }
+};
+
+#endif
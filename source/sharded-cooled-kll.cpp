@@ -0,0 +1,228 @@
+#ifndef SHARDED_COOLED_KLL_CPP
+#define SHARDED_COOLED_KLL_CPP
+
+#include <thread>
+
+#include "cooled-kll.cpp"
+
+
+/**
+ * Cooled-KLL built by several threads. A batch is split by position into as many slices as
+ * shards, each one a Cooled-KLL with its own slice of the hot filter and its own KLL that only
+ * one thread inserts into. The shards are combined when a query comes in, merging their
+ * summaries, which is exact whatever the elements each shard received. Splitting by position
+ * instead of by value keeps the threads balanced even when a few values are most of the data.
+ */
+template <typename T = int_t>
+class ShardedCooledKLL{
+private:
+    std::vector<CooledKLL<T>> shards;
+    // Sorted view of all the shards used by the queries, dropped on every insert.
+    Summary<T> summary;
+    bool summary_valid;
+    // Shard that receives the next single insert
+    size_t next_shard;
+public:
+    /**
+     * @brief Construct a new sharded Cooled-KLL object.
+     *
+     * @param n_shards Number of shards, which is also the number of threads used by insert_batch.
+     * @param n_buckets Number of buckets in the whole hot filter, split evenly among the shards.
+     * @param buckets_capacity Number of entries per bucket.
+     * @param eviction_threshold Threshold to evict an element to the kll component.
+     * @param k Capacity of the largest compactor in the kll of every shard.
+     * @param c Compression factor for creating a new compactor in the KLL.
+     * @param seed Seed of the coin flips of the first shard, the next ones use the following seeds.
+     */
+    ShardedCooledKLL(size_t n_shards, size_t n_buckets, size_t buckets_capacity, int eviction_threshold, int k, float c,
+        uint64_t seed = std::random_device{}())
+    {
+        if (n_shards == 0){
+            throw std::invalid_argument("there must be at least one shard");
+        }
+        size_t shard_buckets = std::max<size_t>(n_buckets / n_shards, 1);
+        shards.reserve(n_shards);
+        for (size_t i=0 ; i<n_shards ; i++){
+            shards.emplace_back(shard_buckets, buckets_capacity, eviction_threshold, k, c, seed + i);
+        }
+        this->summary_valid = false;
+        this->next_shard = 0;
+    }
+
+    /**
+     * @brief Inserts an element from the calling thread, taking the shards in turns.
+     *
+     * @param element Element to insert.
+     * @param frequency Times the element is inserted.
+     */
+    void insert(T element, size_t frequency = 1){
+        summary_valid = false;
+        shards[next_shard].insert(element, frequency);
+        next_shard = (next_shard + 1) % shards.size();
+    }
+
+    /**
+     * @brief Inserts a batch of elements using one thread per shard: thread t inserts the
+     * t-th slice of the batch into shard t, in the order of the batch.
+     *
+     * @param elements Elements to insert.
+     */
+    void insert_batch(std::span<const T> elements){
+        parallelInsert(elements.size(), [&](CooledKLL<T>& shard, size_t begin, size_t end){
+            shard.insert_batch(elements.subspan(begin, end - begin));
+        });
+    }
+
+    /**
+     * @brief Inserts a batch of elements with their frequencys, as insert_batch.
+     *
+     * @param elements Pairs (element, frequency) to insert.
+     */
+    void insert_batch(std::span<const std::pair<T, size_t>> elements){
+        parallelInsert(elements.size(), [&](CooledKLL<T>& shard, size_t begin, size_t end){
+            shard.insert_batch(elements.subspan(begin, end - begin));
+        });
+    }
+
+    /**
+     * @brief Inserts the element that element(item) gives for every item, as insert_batch.
+     *
+     * @param items Items to insert.
+     * @param element Callable returning the element to insert for an item.
+     */
+    template <typename Item, typename Element>
+    void insert_batch(std::span<Item> items, Element element){
+        parallelInsert(items.size(), [&](CooledKLL<T>& shard, size_t begin, size_t end){
+            shard.insert_batch(items.subspan(begin, end - begin), element);
+        });
+    }
+
+    /**
+     * @brief Chooses the ranks answered with the most accuracy by the KLL of every shard.
+     * 
+     * @param accuracy UNIFORM for the classic KLL, or the tails whose error is relative.
+     */
+    void setRankAccuracy(RankAccuracy accuracy){
+        for (size_t s=0 ; s<shards.size() ; s++) shards[s].setRankAccuracy(accuracy);
+    }
+
+    /**
+     * @brief Estimates the rank of the given element.
+     *
+     * @param element Element to estimate the rank.
+     * @return size_t Amount of elements that are less or equal to element.
+     */
+    size_t rank(T element){
+        return getSummary().rank(element);
+    }
+
+    /**
+     * @brief Estimates the delta-quantile of the data in the sketch.
+     *
+     * @param delta Quantile to estimate.
+     * @return T Element that is the delta-quantile of the data.
+     */
+    T quantile(float delta){
+        if (delta < 0 or 1 < delta){
+            throw std::invalid_argument("delta must belong to [0, 1]");
+        }
+        const Summary<T>& elements = getSummary();
+        if (elements.items.empty()){
+            throw std::out_of_range("the sketch is empty");
+        }
+
+        size_t quantile_pos = static_cast<size_t>(std::round(delta * elements.total()));
+        return elements.items[elements.position(quantile_pos)];
+    }
+
+    /**
+     * @brief Estimates the rank of a batch of elements building the summary only once.
+     *
+     * @param elements Elements to estimate the rank, preferably in ascending order.
+     * @return std::vector<size_t> Amount of elements that are less or equal to each element.
+     */
+    std::vector<size_t> ranks(std::span<const T> elements){
+        return getSummary().rank(elements);
+    }
+
+    /**
+     * @brief Estimates a batch of quantiles building the summary only once.
+     *
+     * @param deltas Quantiles to estimate, preferably in ascending order.
+     * @return std::vector<T> Element that is each of the quantiles, in the same order.
+     */
+    std::vector<T> quantiles(std::span<const double> deltas){
+        const Summary<T>& elements = getSummary();
+        if (elements.items.empty()){
+            throw std::out_of_range("the sketch is empty");
+        }
+
+        std::vector<size_t> indexes = elements.position(Summary<T>::positions(deltas, elements.total()));
+        std::vector<T> answer(deltas.size());
+        for (size_t q=0 ; q<deltas.size() ; q++){
+            answer[q] = elements.items[indexes[q]];
+        }
+        return answer;
+    }
+
+    /**
+     * @brief Gets the summaries of all the shards merged, rebuilding it only if an insertion
+     * happened since the last query.
+     *
+     * @return const Summary<T>& Items of the sketch sorted with their accumulated weights.
+     */
+    const Summary<T>& getSummary(){
+        if (summary_valid) return summary;
+
+        std::vector<std::pair<T, size_t>> data;
+        for (size_t s=0 ; s<shards.size() ; s++){
+            const Summary<T>& shard_summary = shards[s].getSummary();
+            size_t shard_size = shard_summary.items.size();
+            for (size_t j=0 ; j<shard_size ; j++){
+                data.push_back(std::make_pair(shard_summary.items[j], shard_summary.ranks[j] - (j == 0 ? 0 : shard_summary.ranks[j-1])));
+            }
+        }
+        std::stable_sort(data.begin(), data.end(), [](const std::pair<T, size_t>& a, const std::pair<T, size_t>& b){
+            return a.first < b.first;
+        });
+
+        summary.build(data);
+        summary_valid = true;
+        return summary;
+    }
+
+    /**
+     * @brief Determines used memory of the object.
+     *
+     * @return size_t: used memory in bytes.
+     */
+    size_t memory(){
+        size_t memory_used = sizeof(*this);
+        for (size_t s=0 ; s<shards.size() ; s++){
+            memory_used += shards[s].memory();
+        }
+        return memory_used;
+    }
+
+private:
+    /**
+     * @brief Splits count elements by position into one contiguous slice per shard and has
+     * a thread per shard call insert(shard, begin, end) with its slice.
+     */
+    template <typename Insert>
+    void parallelInsert(size_t count, Insert insert){
+        summary_valid = false;
+        size_t n_shards = shards.size();
+
+        auto worker = [&](size_t t){
+            insert(shards[t], count * t / n_shards, count * (t + 1) / n_shards);
+        };
+
+        std::vector<std::thread> threads;
+        for (size_t t=1 ; t<n_shards ; t++) threads.emplace_back(worker, t);
+        worker(0);
+        for (size_t t=0 ; t<threads.size() ; t++) threads[t].join();
+    }
+};
+
+#endif
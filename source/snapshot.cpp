@@ -0,0 +1,297 @@
+#ifndef SNAPSHOT_CPP
+#define SNAPSHOT_CPP
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "mapped-file.cpp"
+
+/*
+ * Binary snapshot of a sketch (version 2). Every field is a little-endian 64-bit word,
+ * except magic, version and kind, so every section is 8-byte aligned:
+ *
+ *   header (64 bytes):  magic "CKLLSNAP", u32 version, u32 kind, summary_offset,
+ *                       summary_size, total_weight, kll_offset, hot_filter_offset, flags
+ *   summary:            items[summary_size], ranks[summary_size] (accumulated weights)
+ *   kll:                k, c (float bits), height, heavy_count, coin state, coin word,
+ *                       coin bits, rank_accuracy, sizes[height+1], schedules[height+1],
+ *                       items of every compactor from the top one down, heavy (item,
+ *                       weight) pairs
+ *   hot filter:         n_buckets, buckets_capacity, eviction_threshold, votes[n_buckets],
+ *                       counts[n_buckets], items[n_buckets * capacity],
+ *                       frequencys[n_buckets * capacity]
+ *
+ * The summary lets a mapped file answer rank and quantile in place; the other sections
+ * restore the full sketch. KLL snapshots have no hot filter (offset 0). Files written before
+ * the flags existed have 0 in their place. Version 1 files lack rank_accuracy and schedules,
+ * and are read as uniform sketches.
+ */
+const char SNAPSHOT_MAGIC[8] = {'C', 'K', 'L', 'L', 'S', 'N', 'A', 'P'};
+const uint32_t SNAPSHOT_VERSION = 2;
+const size_t SNAPSHOT_HEADER_SIZE = 64;
+
+// Flags of the header
+const uint64_t SNAPSHOT_TWO_CHOICE = 1;
+
+enum SnapshotKind{
+    SNAPSHOT_KLL = 1,
+    SNAPSHOT_COOLED_KLL = 2
+};
+
+/**
+ * @brief Converts a word between the host byte order and little-endian.
+ */
+inline uint64_t littleEndian(uint64_t x){
+    if constexpr (std::endian::native == std::endian::big){
+        uint64_t swapped = 0;
+        for (int i=0 ; i<8 ; i++){
+            swapped = (swapped << 8) | (x & 0xff);
+            x >>= 8;
+        }
+        return swapped;
+    }
+    return x;
+}
+
+inline uint32_t littleEndian(uint32_t x){
+    if constexpr (std::endian::native == std::endian::big){
+        return (x >> 24) | ((x >> 8) & 0xff00) | ((x << 8) & 0xff0000) | (x << 24);
+    }
+    return x;
+}
+
+/**
+ * Writes the words of a snapshot to a file.
+ */
+class SnapshotWriter{
+private:
+    std::ofstream file;
+public:
+    SnapshotWriter(const std::string& path) : file(path, std::ios::binary | std::ios::trunc){
+        if (not file.is_open()){
+            throw std::runtime_error("could not open " + path);
+        }
+    }
+
+    /**
+     * @brief Writes the header with the offsets of the sections still unknown.
+     */
+    void header(SnapshotKind kind){
+        file.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        uint32_t version = littleEndian(SNAPSHOT_VERSION), k = littleEndian(static_cast<uint32_t>(kind));
+        file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        file.write(reinterpret_cast<const char*>(&k), sizeof(k));
+        for (size_t i=0 ; i<6 ; i++) word(0);
+    }
+
+    /**
+     * @brief Fills a field of the header once its value is known.
+     *
+     * @param field Index of the 64-bit field after magic, version and kind.
+     * @param value Value of the field.
+     */
+    void headerField(size_t field, uint64_t value){
+        std::streampos end = file.tellp();
+        file.seekp(16 + field * sizeof(uint64_t));
+        word(value);
+        file.seekp(end);
+    }
+
+    void word(uint64_t value){
+        value = littleEndian(value);
+        file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    template <typename T>
+    void words(const T* values, size_t count){
+        for (size_t i=0 ; i<count ; i++) word(static_cast<uint64_t>(values[i]));
+    }
+
+    /**
+     * @brief Writes the summary section and fills its fields in the header.
+     *
+     * @param summary Sorted items of the sketch with their accumulated weights.
+     */
+    template <typename S>
+    void summary(const S& summary){
+        headerField(0, position());
+        headerField(1, summary.items.size());
+        headerField(2, summary.total());
+        words(summary.items.data(), summary.items.size());
+        words(summary.ranks.data(), summary.ranks.size());
+    }
+
+    uint64_t position(){
+        return static_cast<uint64_t>(file.tellp());
+    }
+
+    void close(){
+        file.close();
+        if (file.fail()){
+            throw std::runtime_error("could not write the snapshot");
+        }
+    }
+};
+
+/**
+ * Reads the words of a snapshot, checking that they are inside the file.
+ */
+class SnapshotReader{
+private:
+    const unsigned char* bytes;
+    size_t length, pos;
+    uint32_t version;
+public:
+    SnapshotReader(const MappedFile& file) : bytes(file.data()), length(file.size()), pos(0), version(0){}
+
+    /**
+     * @brief Checks the header and returns the kind of sketch stored.
+     */
+    SnapshotKind header(){
+        if (length < SNAPSHOT_HEADER_SIZE or std::memcmp(bytes, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0){
+            throw std::runtime_error("not a sketch snapshot");
+        }
+        uint32_t kind;
+        std::memcpy(&version, bytes + 8, sizeof(version));
+        std::memcpy(&kind, bytes + 12, sizeof(kind));
+        version = littleEndian(version);
+        if (version == 0 or version > SNAPSHOT_VERSION){
+            throw std::runtime_error("unsupported snapshot version " + std::to_string(version));
+        }
+        return static_cast<SnapshotKind>(littleEndian(kind));
+    }
+
+    /**
+     * @brief Version of the snapshot, known once the header is checked.
+     */
+    uint32_t getVersion() const{
+        return version;
+    }
+
+    uint64_t headerField(size_t field){
+        seek(16 + field * sizeof(uint64_t));
+        return word();
+    }
+
+    void seek(uint64_t offset){
+        if (offset > length) throw std::runtime_error("truncated snapshot");
+        pos = offset;
+    }
+
+    uint64_t word(){
+        if (pos + sizeof(uint64_t) > length) throw std::runtime_error("truncated snapshot");
+        uint64_t value;
+        std::memcpy(&value, bytes + pos, sizeof(value));
+        pos += sizeof(value);
+        return littleEndian(value);
+    }
+
+    /**
+     * @brief Number of whole words left after the current position.
+     */
+    size_t remainingWords() const{
+        return (length - pos) / sizeof(uint64_t);
+    }
+
+    template <typename T>
+    void words(T* values, size_t count){
+        for (size_t i=0 ; i<count ; i++) values[i] = static_cast<T>(word());
+    }
+
+    /**
+     * @brief Gives the next count words in place, without copying them when the host is
+     * little-endian.
+     *
+     * @param count Number of words.
+     * @param copy Storage used when the words must be converted.
+     */
+    const uint64_t* array(size_t count, std::vector<uint64_t>& copy){
+        if (count > (length - pos) / sizeof(uint64_t)) throw std::runtime_error("truncated snapshot");
+        const uint64_t* values = reinterpret_cast<const uint64_t*>(bytes + pos);
+        if constexpr (std::endian::native == std::endian::big){
+            copy.resize(count);
+            words(copy.data(), count);
+            return copy.data();
+        }
+        pos += count * sizeof(uint64_t);
+        return values;
+    }
+};
+
+/**
+ * Snapshot of a KLL or Cooled-KLL opened for queries only. The file is mapped and rank and
+ * quantile are answered with binary searches over its summary, with no deserialization.
+ */
+class SketchSnapshot{
+private:
+    MappedFile file;
+    SnapshotKind kind;
+    const uint64_t* items;
+    const uint64_t* ranks;
+    size_t size, total;
+    std::vector<uint64_t> items_copy, ranks_copy;
+public:
+    /**
+     * @brief Opens a snapshot written by KLL::save or CooledKLL::save.
+     *
+     * @param path Path to the snapshot.
+     */
+    SketchSnapshot(const std::string& path) : file(path){
+        SnapshotReader reader(file);
+        kind = reader.header();
+        uint64_t offset = reader.headerField(0);
+        size = reader.headerField(1);
+        total = reader.headerField(2);
+        reader.seek(offset);
+        items = reader.array(size, items_copy);
+        ranks = reader.array(size, ranks_copy);
+    }
+
+    /**
+     * @brief Estimates the rank of the given element.
+     *
+     * @param element Element to estimate the rank.
+     * @return size_t Amount of elements that are less or equal to element.
+     */
+    size_t rank(uint64_t element) const{
+        size_t idx = std::upper_bound(items, items + size, element) - items;
+        return idx == 0 ? 0 : ranks[idx-1];
+    }
+
+    /**
+     * @brief Estimates the delta-quantile of the data in the sketch, the same way the saved
+     * sketch would.
+     *
+     * @param delta Quantile to estimate.
+     * @return uint64_t Element that is the delta-quantile of the data.
+     */
+    uint64_t quantile(double delta) const{
+        if (delta < 0 or 1 < delta){
+            throw std::invalid_argument("delta must belong to [0, 1]");
+        }
+        if (size == 0){
+            throw std::out_of_range("the sketch is empty");
+        }
+        size_t pos = static_cast<size_t>(std::round(delta * total));
+        size_t i = std::min(static_cast<size_t>(std::upper_bound(ranks, ranks + size, pos) - ranks), size - 1);
+        if (kind == SNAPSHOT_KLL and ranks[i] > pos and i != 0) return items[i-1];
+        return items[i];
+    }
+
+    /**
+     * @brief Total weight of the data in the sketch.
+     */
+    size_t getSketch_size() const{
+        return total;
+    }
+};
+
+#endif
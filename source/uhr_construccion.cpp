@@ -168,11 +168,11 @@ int main(int argc, char *argv[])
                     size_t n_buckets = 100, buckets_capacity = 10;
                     int compactor_size = 100, eviction_threshold = 16;
                     float compression_factor = 0.7;
-                    size_t total_kmers = kmers.size();
-                    CooledKLL sketch(n_buckets, buckets_capacity, eviction_threshold, compactor_size, compression_factor);
-                    for (size_t i=0 ; i<total_kmers ; i++){
-                        sketch.insert(kmers[i].second);
-                    }
+                    withCooledKLL(n_buckets, buckets_capacity, eviction_threshold, compactor_size, compression_factor, [&](auto& sketch){
+                        sketch.insert_batch(std::span(kmers), [](const std::pair<uint64_t, size_t>& kmer){
+                            return kmer.second;
+                        });
+                    });
                     break;
                 }
 
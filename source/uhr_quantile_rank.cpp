@@ -174,9 +174,9 @@ int main(int argc, char *argv[])
         // sketch
         case 3:
         {
-            for (size_t i=0 ; i<total_kmers ; i++){
-                sketch.insert(kmers[i].second);
-            }
+            sketch.insert_batch(std::span(kmers), [](const std::pair<uint64_t, size_t>& kmer){
+                return kmer.second;
+            });
             break;
         }
 